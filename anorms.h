@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ANORMS_H__
+#define __ANORMS_H__
+
+/* the normals an md2 vertex's lightNormalIndex picks from */
+#define NUM_ANORMS 162
+
+static const float anorms[NUM_ANORMS][3] = {
+	{ -0.525731f,  0.000000f,  0.850651f },
+	{ -0.442863f,  0.238856f,  0.864188f },
+	{ -0.295242f,  0.000000f,  0.955423f },
+	{ -0.309017f,  0.500000f,  0.809017f },
+	{ -0.162460f,  0.262866f,  0.951056f },
+	{  0.000000f,  0.000000f,  1.000000f },
+	{  0.000000f,  0.850651f,  0.525731f },
+	{ -0.147621f,  0.716567f,  0.681718f },
+	{  0.147621f,  0.716567f,  0.681718f },
+	{  0.000000f,  0.525731f,  0.850651f },
+	{  0.309017f,  0.500000f,  0.809017f },
+	{  0.525731f,  0.000000f,  0.850651f },
+	{  0.295242f,  0.000000f,  0.955423f },
+	{  0.442863f,  0.238856f,  0.864188f },
+	{  0.162460f,  0.262866f,  0.951056f },
+	{ -0.681718f,  0.147621f,  0.716567f },
+	{ -0.809017f,  0.309017f,  0.500000f },
+	{ -0.587785f,  0.425325f,  0.688191f },
+	{ -0.850651f,  0.525731f,  0.000000f },
+	{ -0.864188f,  0.442863f,  0.238856f },
+	{ -0.716567f,  0.681718f,  0.147621f },
+	{ -0.688191f,  0.587785f,  0.425325f },
+	{ -0.500000f,  0.809017f,  0.309017f },
+	{ -0.238856f,  0.864188f,  0.442863f },
+	{ -0.425325f,  0.688191f,  0.587785f },
+	{ -0.716567f,  0.681718f, -0.147621f },
+	{ -0.500000f,  0.809017f, -0.309017f },
+	{ -0.525731f,  0.850651f,  0.000000f },
+	{  0.000000f,  0.850651f, -0.525731f },
+	{ -0.238856f,  0.864188f, -0.442863f },
+	{  0.000000f,  0.955423f, -0.295242f },
+	{ -0.262866f,  0.951056f, -0.162460f },
+	{  0.000000f,  1.000000f,  0.000000f },
+	{  0.000000f,  0.955423f,  0.295242f },
+	{ -0.262866f,  0.951056f,  0.162460f },
+	{  0.238856f,  0.864188f,  0.442863f },
+	{  0.262866f,  0.951056f,  0.162460f },
+	{  0.500000f,  0.809017f,  0.309017f },
+	{  0.238856f,  0.864188f, -0.442863f },
+	{  0.262866f,  0.951056f, -0.162460f },
+	{  0.500000f,  0.809017f, -0.309017f },
+	{  0.850651f,  0.525731f,  0.000000f },
+	{  0.716567f,  0.681718f,  0.147621f },
+	{  0.716567f,  0.681718f, -0.147621f },
+	{  0.525731f,  0.850651f,  0.000000f },
+	{  0.425325f,  0.688191f,  0.587785f },
+	{  0.864188f,  0.442863f,  0.238856f },
+	{  0.688191f,  0.587785f,  0.425325f },
+	{  0.809017f,  0.309017f,  0.500000f },
+	{  0.681718f,  0.147621f,  0.716567f },
+	{  0.587785f,  0.425325f,  0.688191f },
+	{  0.955423f,  0.295242f,  0.000000f },
+	{  1.000000f,  0.000000f,  0.000000f },
+	{  0.951056f,  0.162460f,  0.262866f },
+	{  0.850651f, -0.525731f,  0.000000f },
+	{  0.955423f, -0.295242f,  0.000000f },
+	{  0.864188f, -0.442863f,  0.238856f },
+	{  0.951056f, -0.162460f,  0.262866f },
+	{  0.809017f, -0.309017f,  0.500000f },
+	{  0.681718f, -0.147621f,  0.716567f },
+	{  0.850651f,  0.000000f,  0.525731f },
+	{  0.864188f,  0.442863f, -0.238856f },
+	{  0.809017f,  0.309017f, -0.500000f },
+	{  0.951056f,  0.162460f, -0.262866f },
+	{  0.525731f,  0.000000f, -0.850651f },
+	{  0.681718f,  0.147621f, -0.716567f },
+	{  0.681718f, -0.147621f, -0.716567f },
+	{  0.850651f,  0.000000f, -0.525731f },
+	{  0.809017f, -0.309017f, -0.500000f },
+	{  0.864188f, -0.442863f, -0.238856f },
+	{  0.951056f, -0.162460f, -0.262866f },
+	{  0.147621f,  0.716567f, -0.681718f },
+	{  0.309017f,  0.500000f, -0.809017f },
+	{  0.425325f,  0.688191f, -0.587785f },
+	{  0.442863f,  0.238856f, -0.864188f },
+	{  0.587785f,  0.425325f, -0.688191f },
+	{  0.688191f,  0.587785f, -0.425325f },
+	{ -0.147621f,  0.716567f, -0.681718f },
+	{ -0.309017f,  0.500000f, -0.809017f },
+	{  0.000000f,  0.525731f, -0.850651f },
+	{ -0.525731f,  0.000000f, -0.850651f },
+	{ -0.442863f,  0.238856f, -0.864188f },
+	{ -0.295242f,  0.000000f, -0.955423f },
+	{ -0.162460f,  0.262866f, -0.951056f },
+	{  0.000000f,  0.000000f, -1.000000f },
+	{  0.295242f,  0.000000f, -0.955423f },
+	{  0.162460f,  0.262866f, -0.951056f },
+	{ -0.442863f, -0.238856f, -0.864188f },
+	{ -0.309017f, -0.500000f, -0.809017f },
+	{ -0.162460f, -0.262866f, -0.951056f },
+	{  0.000000f, -0.850651f, -0.525731f },
+	{ -0.147621f, -0.716567f, -0.681718f },
+	{  0.147621f, -0.716567f, -0.681718f },
+	{  0.000000f, -0.525731f, -0.850651f },
+	{  0.309017f, -0.500000f, -0.809017f },
+	{  0.442863f, -0.238856f, -0.864188f },
+	{  0.162460f, -0.262866f, -0.951056f },
+	{  0.238856f, -0.864188f, -0.442863f },
+	{  0.500000f, -0.809017f, -0.309017f },
+	{  0.425325f, -0.688191f, -0.587785f },
+	{  0.716567f, -0.681718f, -0.147621f },
+	{  0.688191f, -0.587785f, -0.425325f },
+	{  0.587785f, -0.425325f, -0.688191f },
+	{  0.000000f, -0.955423f, -0.295242f },
+	{  0.000000f, -1.000000f,  0.000000f },
+	{  0.262866f, -0.951056f, -0.162460f },
+	{  0.000000f, -0.850651f,  0.525731f },
+	{  0.000000f, -0.955423f,  0.295242f },
+	{  0.238856f, -0.864188f,  0.442863f },
+	{  0.262866f, -0.951056f,  0.162460f },
+	{  0.500000f, -0.809017f,  0.309017f },
+	{  0.716567f, -0.681718f,  0.147621f },
+	{  0.525731f, -0.850651f,  0.000000f },
+	{ -0.238856f, -0.864188f, -0.442863f },
+	{ -0.500000f, -0.809017f, -0.309017f },
+	{ -0.262866f, -0.951056f, -0.162460f },
+	{ -0.850651f, -0.525731f,  0.000000f },
+	{ -0.716567f, -0.681718f, -0.147621f },
+	{ -0.716567f, -0.681718f,  0.147621f },
+	{ -0.525731f, -0.850651f,  0.000000f },
+	{ -0.500000f, -0.809017f,  0.309017f },
+	{ -0.238856f, -0.864188f,  0.442863f },
+	{ -0.262866f, -0.951056f,  0.162460f },
+	{ -0.864188f, -0.442863f,  0.238856f },
+	{ -0.809017f, -0.309017f,  0.500000f },
+	{ -0.688191f, -0.587785f,  0.425325f },
+	{ -0.681718f, -0.147621f,  0.716567f },
+	{ -0.442863f, -0.238856f,  0.864188f },
+	{ -0.587785f, -0.425325f,  0.688191f },
+	{ -0.309017f, -0.500000f,  0.809017f },
+	{ -0.147621f, -0.716567f,  0.681718f },
+	{ -0.425325f, -0.688191f,  0.587785f },
+	{ -0.162460f, -0.262866f,  0.951056f },
+	{  0.442863f, -0.238856f,  0.864188f },
+	{  0.162460f, -0.262866f,  0.951056f },
+	{  0.309017f, -0.500000f,  0.809017f },
+	{  0.147621f, -0.716567f,  0.681718f },
+	{  0.000000f, -0.525731f,  0.850651f },
+	{  0.425325f, -0.688191f,  0.587785f },
+	{  0.587785f, -0.425325f,  0.688191f },
+	{  0.688191f, -0.587785f,  0.425325f },
+	{ -0.955423f,  0.295242f,  0.000000f },
+	{ -0.951056f,  0.162460f,  0.262866f },
+	{ -1.000000f,  0.000000f,  0.000000f },
+	{ -0.850651f,  0.000000f,  0.525731f },
+	{ -0.955423f, -0.295242f,  0.000000f },
+	{ -0.951056f, -0.162460f,  0.262866f },
+	{ -0.864188f,  0.442863f, -0.238856f },
+	{ -0.951056f,  0.162460f, -0.262866f },
+	{ -0.809017f,  0.309017f, -0.500000f },
+	{ -0.864188f, -0.442863f, -0.238856f },
+	{ -0.951056f, -0.162460f, -0.262866f },
+	{ -0.809017f, -0.309017f, -0.500000f },
+	{ -0.681718f,  0.147621f, -0.716567f },
+	{ -0.681718f, -0.147621f, -0.716567f },
+	{ -0.850651f,  0.000000f, -0.525731f },
+	{ -0.688191f,  0.587785f, -0.425325f },
+	{ -0.587785f,  0.425325f, -0.688191f },
+	{ -0.425325f,  0.688191f, -0.587785f },
+	{ -0.425325f, -0.688191f, -0.587785f },
+	{ -0.587785f, -0.425325f, -0.688191f },
+	{ -0.688191f, -0.587785f, -0.425325f }
+};
+
+#endif /* __ANORMS_H__ */
@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * loads textures and models on threads of their own, so the loads overlap
+ * each other and whatever the main thread does in the meantime, like
+ * setting up the GL context. nothing here touches GL; the caller picks up
+ * the assets in the order they finish and uploads them itself
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_math.h"
+#include "mapfile.h"
+#include "md2cache.h"
+#include "mipmap.h"
+#include "pcx.h"
+#include "textures.h"
+#include "threads.h"
+#include "assets.h"
+
+/* save textures' mipmaps next to them, so they're only made once */
+#define CACHE_MIPMAPS
+
+#define MAX_ASSETS 32
+
+static struct asset assets[MAX_ASSETS];
+static unsigned int num_assets = 0;
+static unsigned int next_asset = 0; /* the next one a loader takes */
+static unsigned int num_returned = 0;
+
+/* loaded assets not picked up yet, oldest first */
+static struct asset *loaded_head = NULL;
+static struct asset *loaded_tail = NULL;
+
+static pthread_t loaders[MAX_ASSETS];
+static int num_loaders = 0;
+
+static pthread_mutex_t assets_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loaded_cond = PTHREAD_COND_INITIALIZER;
+
+static double
+get_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static struct asset *
+add_asset(int type, const char *filename, int id)
+{
+	struct asset *ap;
+	unsigned int i;
+
+	/* a file's only loaded once, whatever it's for */
+	for(i = 0; i < num_assets; i++) {
+		if(assets[i].type == type && strcmp(assets[i].filename, filename) == 0)
+			return &(assets[i]);
+	}
+
+	if(num_loaders || num_assets == MAX_ASSETS) {
+		fprintf(stderr, "Error: Can't add %s to the assets being loaded\n", filename);
+		return NULL;
+	}
+	if(strlen(filename) >= sizeof(ap->filename)) {
+		fprintf(stderr, "Error: File name %s is too long\n", filename);
+		return NULL;
+	}
+
+	ap = &(assets[num_assets++]);
+	memset(ap, 0, sizeof(struct asset));
+	ap->type = type;
+	strcpy(ap->filename, filename);
+	ap->id = id;
+
+	return ap;
+}
+
+int
+assets_add_texture(const char *filename, int id)
+{
+	return (add_asset(ASSET_TEXTURE, filename, id) != NULL);
+}
+
+int
+assets_add_indexed_texture(const char *filename, int id)
+{
+	return (add_asset(ASSET_INDEXED_TEXTURE, filename, id) != NULL);
+}
+
+int
+assets_add_model(const char *filename, int id, void (*prepare)(struct md2_model *mp))
+{
+	struct asset *ap;
+
+	ap = add_asset(ASSET_MODEL, filename, id);
+	if(!ap)
+		return FALSE;
+	ap->prepare = prepare;
+
+	return TRUE;
+}
+
+/*
+ * decode a texture and make its mipmaps, or read both from the cache next
+ * to it. an indexed texture's palette is read along with it
+ */
+static int
+load_texture_pixels(struct asset *ap)
+{
+	void *file;
+	size_t size, pixels_size, chain_size;
+	unsigned int components;
+#ifdef CACHE_MIPMAPS
+	char cache_filename[sizeof(ap->filename) + 8];
+	uint64_t source_hash;
+#endif /* CACHE_MIPMAPS */
+
+	file = map_file(ap->filename, &size);
+	if(!file)
+		return FALSE;
+
+	if(!pcx_get_size(file, size, &(ap->width), &(ap->height))) {
+		unmap_file(file, size);
+		return FALSE;
+	}
+
+	components = (ap->type == ASSET_INDEXED_TEXTURE) ? 1 : 4;
+	chain_size = mipmap_size(ap->width, ap->height, components);
+	pixels_size = chain_size + ((components == 1) ? 256 * 4 : 0);
+	ap->pixels = malloc(pixels_size);
+	if(!ap->pixels) {
+		fprintf(stderr, "Error: Couldn't allocate memory for %s\n", ap->filename);
+		unmap_file(file, size);
+		return FALSE;
+	}
+	if(components == 1)
+		ap->palette = ap->pixels + chain_size;
+
+#ifdef CACHE_MIPMAPS
+	source_hash = md2_cache_hash(file, size);
+	snprintf(cache_filename, sizeof(cache_filename), "%s.mips", ap->filename);
+	if(mipmap_cache_load(cache_filename, size, source_hash, ap->width, ap->height, components, ap->pixels, pixels_size, &(ap->hash))) {
+		unmap_file(file, size);
+		return TRUE;
+	}
+#endif /* CACHE_MIPMAPS */
+
+	if(!pcx_decode(file, size, ap->pixels, components) ||
+	   (ap->palette && !pcx_get_palette(file, size, ap->palette)) ||
+	   (ap->palette && !mipmap_generate_indexed(ap->pixels, ap->palette, ap->width, ap->height))) {
+		free(ap->pixels);
+		ap->pixels = ap->palette = NULL;
+		unmap_file(file, size);
+		return FALSE;
+	}
+
+	if(!ap->palette)
+		mipmap_generate(ap->pixels, ap->width, ap->height);
+	ap->hash = textures_hash(ap->pixels, ap->palette, ap->width, ap->height);
+#ifdef CACHE_MIPMAPS
+	mipmap_cache_write(cache_filename, size, source_hash, ap->width, ap->height, components, ap->pixels, pixels_size, ap->hash);
+#endif /* CACHE_MIPMAPS */
+
+	unmap_file(file, size);
+	return TRUE;
+}
+
+static void
+load_asset(struct asset *ap)
+{
+	double start;
+
+	start = get_seconds();
+	if(ap->type == ASSET_MODEL) {
+		ap->mp = md2_load(ap->filename);
+		ap->failed = (ap->mp == NULL);
+		if(ap->mp && ap->prepare)
+			ap->prepare(ap->mp);
+	} else {
+		ap->failed = !load_texture_pixels(ap);
+	}
+	ap->seconds = get_seconds() - start;
+
+	if(ap->failed)
+		fprintf(stderr, "Error: Unable to load %s\n", ap->filename);
+}
+
+/* add an asset to the ones waiting to be picked up; called with assets_lock held */
+static void
+push_loaded(struct asset *ap)
+{
+	if(loaded_tail)
+		loaded_tail->next_loaded = ap;
+	else
+		loaded_head = ap;
+	loaded_tail = ap;
+	pthread_cond_signal(&loaded_cond);
+}
+
+static void *
+loader(void *arg)
+{
+	struct asset *ap;
+
+	pthread_mutex_lock(&assets_lock);
+	while(next_asset < num_assets) {
+		ap = &(assets[next_asset++]);
+		pthread_mutex_unlock(&assets_lock);
+
+		load_asset(ap);
+
+		pthread_mutex_lock(&assets_lock);
+		push_loaded(ap);
+	}
+	pthread_mutex_unlock(&assets_lock);
+
+	return NULL;
+}
+
+/*
+ * start loading everything that's been added, on as many threads as
+ * there are processors; if no threads can be started, the assets are
+ * loaded one at a time by assets_next_loaded()
+ */
+void
+assets_start()
+{
+	int i, num;
+
+	num = threads_count();
+	if(num > (int)num_assets)
+		num = num_assets;
+
+	for(i = 0; i < num; i++) {
+		if(pthread_create(&(loaders[i]), NULL, loader, NULL) != 0) {
+			fprintf(stderr, "Error: Couldn't create loader thread\n");
+			break;
+		}
+	}
+	num_loaders = i;
+}
+
+/*
+ * wait for the next asset to finish loading and return it, or return NULL
+ * once all of them have been returned
+ */
+struct asset *
+assets_next_loaded()
+{
+	struct asset *ap;
+
+	pthread_mutex_lock(&assets_lock);
+	if(num_returned == num_assets) {
+		pthread_mutex_unlock(&assets_lock);
+		return NULL;
+	}
+
+	/* with nothing else to load them, they're loaded here one at a time */
+	if(!num_loaders && !loaded_head) {
+		ap = &(assets[next_asset++]);
+		pthread_mutex_unlock(&assets_lock);
+		load_asset(ap);
+		pthread_mutex_lock(&assets_lock);
+		push_loaded(ap);
+	}
+
+	while(!loaded_head)
+		pthread_cond_wait(&loaded_cond, &assets_lock);
+
+	ap = loaded_head;
+	loaded_head = ap->next_loaded;
+	if(!loaded_head)
+		loaded_tail = NULL;
+	num_returned++;
+	pthread_mutex_unlock(&assets_lock);
+
+	return ap;
+}
+
+/* wait for the loaders and forget the assets; what's been loaded belongs to the caller */
+void
+assets_finish()
+{
+	int i;
+
+	for(i = 0; i < num_loaders; i++)
+		pthread_join(loaders[i], NULL);
+
+	num_loaders = 0;
+	num_assets = 0;
+	next_asset = 0;
+	num_returned = 0;
+	loaded_head = loaded_tail = NULL;
+}
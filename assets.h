@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <stdint.h>
+#include "md2.h"
+
+#define ASSET_TEXTURE			0
+#define ASSET_MODEL				1
+#define ASSET_INDEXED_TEXTURE	2 /* kept as palette indices */
+
+/* a texture or model to load, and what it was loaded into */
+struct asset {
+	int type;
+	char filename[256];
+	int id; /* for the caller to tell assets apart; a file added twice keeps its first */
+	void (*prepare)(struct md2_model *mp); /* run on a model once it's loaded */
+
+	int failed;
+	double seconds; /* how long it took to load */
+
+	/*
+	 * a texture's pixels, as rgba or palette indices, followed by its
+	 * mipmaps; an indexed texture's palette is after those, in the same
+	 * allocation
+	 */
+	unsigned char *pixels;
+	unsigned char *palette;
+	unsigned int width, height;
+	uint64_t hash; /* from textures_hash */
+
+	struct md2_model *mp;
+
+	struct asset *next_loaded;
+};
+
+int assets_add_texture(const char *filename, int id);
+int assets_add_indexed_texture(const char *filename, int id);
+int assets_add_model(const char *filename, int id, void (*prepare)(struct md2_model *mp));
+void assets_start();
+struct asset *assets_next_loaded();
+void assets_finish();
+
+#endif /* __ASSETS_H__ */
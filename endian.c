@@ -128,6 +128,12 @@ swap_ushort(uint16_t s)
 	return retval;
 }
 
+int
+is_little_endian()
+{
+	return (set_endian() == LITTLE_ENDIAN);
+}
+
 float
 le_to_native_float(float f)
 {
@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #endif
 
+int is_little_endian();
 float le_to_native_float(float f);
 int32_t le_to_native_int(int32_t i);
 uint32_t le_to_native_uint(uint32_t i);
@@ -31,6 +31,8 @@ extern int window;
 
 extern void scene_free();
 extern int light;
+extern int shadow_maps;
+extern int gpu_shadows;
 
 void
 key_press(unsigned char key, int x, int y)
@@ -38,6 +40,12 @@ key_press(unsigned char key, int x, int y)
 	switch(key) {
 		default:
 			break;
+		case 'm':
+			shadow_maps = shadow_maps ? 0 : 1;
+			break;
+		case 'g':
+			gpu_shadows = gpu_shadows ? 0 : 1;
+			break;
 		case 27:
 			scene_free();
 			glutDestroyWindow(window);
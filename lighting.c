@@ -27,8 +27,7 @@
 #include <stdlib.h>
 #include <GL/gl.h>
 #include "my_math.h"
-
-#define MAX_LIGHTS 16
+#include "lighting.h"
 
 struct light {
 	float position[3];
@@ -242,6 +241,42 @@ set_light_size(int n, float size)
 	lights[n]->size = size;
 }
 
+/*
+ * get the distance at which the light's contribution to a lightmap
+ * drops below a single intensity step
+ */
+float
+get_light_radius(int n)
+{
+	lights_pointers_init();
+
+	if(n == -1 || !lights[n])
+		return 0.0f;
+
+	return sqrtf(lights[n]->size * 256.0f);
+}
+
+/*
+ * get how much of the light reaches a point that's d away from it, with
+ * the same falloff as the lightmaps; lights that don't exist give 0
+ */
+float
+light_attenuation(int n, float d[3])
+{
+	float m;
+
+	lights_pointers_init();
+
+	if(n == -1 || !lights[n])
+		return 0.0f;
+
+	m = (d[0]*d[0] + d[1]*d[1] + d[2]*d[2]) * (1.0f / lights[n]->size);
+	if(m <= 1.0f)
+		return 1.0f;
+
+	return 1.0f / m;
+}
+
 void
 set_light_color(int n, float r, float g, float b)
 {
@@ -255,6 +290,19 @@ set_light_color(int n, float r, float g, float b)
 	lights[n]->color[2] = b;
 }
 
+void
+get_light_color(int n, float c[3])
+{
+	lights_pointers_init();
+
+	if(n == -1 || !lights[n])
+		return;
+
+	c[0] = lights[n]->color[0];
+	c[1] = lights[n]->color[1];
+	c[2] = lights[n]->color[2];
+}
+
 int
 create_light()
 {
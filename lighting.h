@@ -26,13 +26,18 @@
 #ifndef __LIGHTING_H__
 #define __LIGHTING_H__
 
+#define MAX_LIGHTS 16
+
 int gen_lightmap_texture(float v[3], float d_x, float d_y, float up[3], float right[3], unsigned char min);
 void render_lights();
 void set_light_position(int n, float p[3]);
 void get_light_position(int n, float p[3]);
 void translate_light_position(int n, float p[3]);
 void set_light_size(int n, float size);
+float get_light_radius(int n);
+float light_attenuation(int n, float d[3]);
 void set_light_color(int n, float r, float g, float b);
+void get_light_color(int n, float c[3]);
 int create_light();
 void destroy_light(int n);
 
@@ -28,6 +28,7 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
+#include "my_math.h"
 
 #define WINWIDTH  640
 #define WINHEIGHT 480
@@ -35,7 +36,8 @@
 
 int window = -1;
 
-extern void scene_load_model(char *md2_filename, char *pcx_filename);
+extern void scene_start_loading(char *md2_filename, char *pcx_filename);
+extern void scene_finish_loading(int num);
 extern void draw_scene();
 extern int light;
 
@@ -93,8 +95,16 @@ int
 main(int argc, char *argv[])
 {
 	int stencil_bits;
+	float proj[16];
 
 	glutInit(&argc, argv);
+
+	/* the assets load while the window and gl are set up */
+	if(argc >= 3)
+		scene_start_loading(argv[1], argv[2]);
+	else
+		scene_start_loading(NULL, NULL);
+
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);
 	glutInitWindowSize(WINWIDTH, WINHEIGHT);
 	window = glutCreateWindow("jab_lighting OpenGL demo by Josh Beam - http://joshbeam.com/");
@@ -121,13 +131,13 @@ main(int argc, char *argv[])
 	glEnable(GL_BLEND);
 	glEnable(GL_DEPTH_TEST);
 
+	/* shadow volumes are extruded to infinity, so the far plane must be too */
 	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(45.0f, (float)WINWIDTH / (float)WINHEIGHT, 0.1f, 999.0f);
+	infinite_perspective_matrix(proj, 45.0f, (float)WINWIDTH / (float)WINHEIGHT, 0.1f);
+	glLoadMatrixf(proj);
 	glMatrixMode(GL_MODELVIEW);
 
-	if(argc >= 3)
-		scene_load_model(argv[1], argv[2]);
+	scene_finish_loading((argc >= 4) ? atoi(argv[3]) : 1);
 
 	glutMainLoop();
 	return 0;
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mapfile.h"
+
+/*
+ * maps a whole file read-only into memory; the pages are shared with the
+ * page cache, so nothing is copied until it's actually touched
+ */
+void *
+map_file(const char *filename, size_t *size)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if(fd == -1) {
+		fprintf(stderr, "Error: Can't open %s\n", filename);
+		return NULL;
+	}
+
+	if(fstat(fd, &st) == -1 || st.st_size <= 0) {
+		fprintf(stderr, "Error: Can't get the size of %s\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		fprintf(stderr, "Error: Can't map %s\n", filename);
+		return NULL;
+	}
+
+	*size = (size_t)st.st_size;
+	return data;
+}
+
+void
+unmap_file(void *data, size_t size)
+{
+	if(data)
+		munmap(data, size);
+}
+
+/*
+ * writes a header and the data after it to filename.tmp, then renames that
+ * over filename, so a reader sees either the old file or the whole new one.
+ * it's only used for caches, which are fine to go without, so failing
+ * (say, in a directory that's read-only) is quiet
+ */
+int
+replace_file(const char *filename, const void *header, size_t header_size,
+             const void *data, size_t size)
+{
+	char *tmp_filename;
+	FILE *fp;
+	int ok;
+
+	tmp_filename = malloc(strlen(filename) + 5);
+	if(!tmp_filename) {
+		fprintf(stderr, "Error: Couldn't allocate memory for file name\n");
+		return 0;
+	}
+	sprintf(tmp_filename, "%s.tmp", filename);
+
+	fp = fopen(tmp_filename, "wb");
+	if(!fp) {
+		free(tmp_filename);
+		return 0;
+	}
+	ok = ((!header_size || fwrite(header, header_size, 1, fp) == 1) &&
+	      (!size || fwrite(data, size, 1, fp) == 1));
+	if(fclose(fp) != 0)
+		ok = 0;
+	if(!ok) {
+		remove(tmp_filename);
+		free(tmp_filename);
+		return 0;
+	}
+
+	if(rename(tmp_filename, filename) != 0) {
+		remove(tmp_filename);
+		free(tmp_filename);
+		return 0;
+	}
+
+	free(tmp_filename);
+	return 1;
+}
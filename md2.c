@@ -23,18 +23,34 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define GL_GLEXT_PROTOTYPES
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <pthread.h>
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include "my_math.h"
 #include "endian.h"
+#include "mapfile.h"
+#include "md2cache.h"
+#include "md2lod.h"
+#include "shader.h"
+#include "threads.h"
+#include "lighting.h"
+#include "anorms.h"
 #include "md2.h"
 
-#define INFINITY 150.0f
+#define SHADOW_EPSILON 0.1f
+
+/* adjacent faces whose normals are closer than this never make a silhouette */
+#define COPLANAR_EPSILON 0.00001f
 
 #define MAX_MODELS 16
 #define MD2_SCALE 0.05f
+#define MD2_MAGIC (('2' << 24) | ('P' << 16) | ('D' << 8) | 'I')
 
 struct md2_anim {
 	unsigned int start_frame;
@@ -58,6 +74,51 @@ static struct md2_anim animations[] = {
 };
 static unsigned int num_animations = sizeof(animations) / sizeof(struct md2_anim);
 
+static float shadow_mins[3], shadow_maxs[3];
+static char shadow_bounds_set = 0;
+
+/*
+ * every vertex of the shadow mesh carries the plane of the face it belongs
+ * to; vertices of faces that don't face the light are pushed away from it
+ * to infinity. this turns the degenerate quads along the edges into the
+ * sides of the volume wherever an edge is on the silhouette
+ */
+static const char *shadow_vertex_src =
+	"uniform vec3 light;\n"
+	"attribute vec4 plane;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 v = gl_Vertex;\n"
+	"\n"
+	"	if(dot(plane.xyz, light) + plane.w <= 0.0)\n"
+	"		v = vec4(v.xyz - light, 0.0);\n"
+	"\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * v;\n"
+	"}\n";
+
+static const char *shadow_attribs[] = { "plane", NULL };
+
+static GLuint shadow_program = 0;
+static GLint shadow_light_uniform = -1;
+
+struct shadow_vertex {
+	float v[3];
+	float plane[4];
+};
+
+/* only used while finding each triangle's neighbours */
+struct md2_tri_edge {
+	char taken;
+
+	short vertexIndices[2];
+	char new_tri;
+	short triangleIndices[2];
+};
+
+#define FACING_WORDS(n) (((n) + 31) >> 5)
+#define FACING(bits, i) (((bits)[(i) >> 5] >> ((i) & 31)) & 1)
+
 struct md2_header {
 	int32_t magic;
 	int32_t version;
@@ -95,6 +156,27 @@ md2_get_animation_frames(unsigned int anim, unsigned int *start_frame,
 	*end_frame = ap->end_frame;
 }
 
+/* arrays that are streamed through every frame are kept cache aligned */
+static void *
+aligned_malloc(size_t size)
+{
+	void *p;
+
+	if(posix_memalign(&p, 64, size ? size : 1) != 0)
+		return NULL;
+
+	return p;
+}
+
+static void
+my_bzero(void *p, unsigned int size)
+{
+	unsigned int i;
+
+	for(i = 0; i < size; i++)
+		((int8_t *)p)[i] = 0;
+}
+
 static void
 transform_vertex(float v[3], float pos[3], float rot[3])
 {
@@ -130,13 +212,261 @@ transform_vertex(float v[3], float pos[3], float rot[3])
 	v[2] += pos[2];
 }
 
+/* the inverse of transform_vertex() */
+static void
+untransform_vertex(float v[3], float pos[3], float rot[3])
+{
+	float tmp[3];
+	float c, s;
+
+	v[0] -= pos[0];
+	v[1] -= pos[1];
+	v[2] -= pos[2];
+
+	tmp[0] = v[0];
+	tmp[1] = v[1];
+	tmp[2] = v[2];
+	c = cosf(DEG2RAD(rot[2]));
+	s = sinf(DEG2RAD(rot[2]));
+	v[0] = tmp[0] * c - tmp[1] * s;
+	v[1] = tmp[1] * c + tmp[0] * s;
+
+	tmp[0] = v[0];
+	tmp[1] = v[1];
+	tmp[2] = v[2];
+	c = cosf(DEG2RAD(rot[1]));
+	s = sinf(DEG2RAD(rot[1]));
+	v[0] = tmp[0] * c - tmp[2] * s;
+	v[2] = tmp[2] * c + tmp[0] * s;
+
+	tmp[0] = v[0];
+	tmp[1] = v[1];
+	tmp[2] = v[2];
+	c = cosf(DEG2RAD(rot[0]));
+	s = sinf(DEG2RAD(rot[0]));
+	v[2] = tmp[2] * c - tmp[1] * s;
+	v[1] = tmp[1] * c + tmp[2] * s;
+}
+
+/* unpack the frame's vertices into positions */
+static void
+decode_frame(struct md2_frame *f, float (*positions)[3])
+{
+	unsigned int i, j;
+
+	for(i = 0; i < f->num_vertices; i++) {
+		for(j = 0; j < 3; j++)
+			positions[i][j] = (f->vertices[i].vertex[j] * f->scale[j] + f->translate[j]) * MD2_SCALE;
+	}
+}
+
+/*
+ * decoded frames are kept in a cache shared by every model, up to a budget
+ * in bytes; when it's over budget the least recently used frames are freed
+ * first. frames in use are pinned, and stay however full the cache gets
+ */
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct md2_frame *lru_first = NULL; /* least recently used */
+static struct md2_frame *lru_last = NULL;
+static size_t frame_cache_size = 0;
+static size_t frame_cache_budget = MD2_FRAME_CACHE_BUDGET;
+
+struct frame_request {
+	struct md2_model *mp;
+	unsigned int frame;
+};
+
+static void
+lru_unlink(struct md2_frame *f)
+{
+	if(f->lru_prev)
+		f->lru_prev->lru_next = f->lru_next;
+	else
+		lru_first = f->lru_next;
+	if(f->lru_next)
+		f->lru_next->lru_prev = f->lru_prev;
+	else
+		lru_last = f->lru_prev;
+	f->lru_prev = f->lru_next = NULL;
+}
+
+static void
+lru_append(struct md2_frame *f)
+{
+	f->lru_prev = lru_last;
+	f->lru_next = NULL;
+	if(lru_last)
+		lru_last->lru_next = f;
+	else
+		lru_first = f;
+	lru_last = f;
+}
+
+/* called with frame_lock held */
+static void
+evict_frame(struct md2_frame *f)
+{
+	lru_unlink(f);
+	free(f->positions);
+	f->positions = NULL;
+	frame_cache_size -= sizeof(float) * 3 * f->num_vertices;
+}
+
+/* free unpinned frames until the cache is within its budget; called with frame_lock held */
+static void
+trim_frame_cache()
+{
+	struct md2_frame *f, *next;
+
+	for(f = lru_first; f && frame_cache_size > frame_cache_budget; f = next) {
+		next = f->lru_next;
+		if(!f->pins)
+			evict_frame(f);
+	}
+}
+
+/*
+ * add a frame that was decoded without the lock held, unless someone else
+ * got there first; called with frame_lock held
+ */
+static void
+insert_frame(struct md2_frame *f, float (*positions)[3])
+{
+	if(f->positions) {
+		free(positions);
+		lru_unlink(f);
+	} else {
+		f->positions = positions;
+		frame_cache_size += sizeof(float) * 3 * f->num_vertices;
+	}
+	lru_append(f);
+}
+
+/* the cache's budget, which pinned frames can go over */
+void
+md2_set_frame_cache_budget(size_t bytes)
+{
+	pthread_mutex_lock(&frame_lock);
+	frame_cache_budget = bytes;
+	trim_frame_cache();
+	pthread_mutex_unlock(&frame_lock);
+}
+
+/*
+ * decode a frame if it isn't cached, and pin it; its positions stay valid
+ * until it's released. returns FALSE if it couldn't be decoded
+ */
+int
+md2_get_frame(struct md2_model *mp, unsigned int frame)
+{
+	struct md2_frame *f = mp->f + frame;
+	float (*positions)[3];
+
+	pthread_mutex_lock(&frame_lock);
+	if(f->positions) {
+		lru_unlink(f);
+		lru_append(f);
+	} else {
+		pthread_mutex_unlock(&frame_lock);
+		positions = aligned_malloc(sizeof(float) * 3 * f->num_vertices);
+		if(!positions) {
+			fprintf(stderr, "Error: Couldn't allocate memory for frame\n");
+			return FALSE;
+		}
+		decode_frame(f, positions);
+
+		pthread_mutex_lock(&frame_lock);
+		insert_frame(f, positions);
+	}
+	f->pins++;
+	trim_frame_cache();
+	pthread_mutex_unlock(&frame_lock);
+
+	return TRUE;
+}
+
+void
+md2_release_frame(struct md2_model *mp, unsigned int frame)
+{
+	pthread_mutex_lock(&frame_lock);
+	if(mp->f[frame].pins > 0)
+		mp->f[frame].pins--;
+	trim_frame_cache();
+	pthread_mutex_unlock(&frame_lock);
+}
+
+static void
+prefetch_frame(void *data)
+{
+	struct frame_request *r = data;
+	struct md2_frame *f = r->mp->f + r->frame;
+	float (*positions)[3];
+	int cached;
+
+	free(r);
+
+	pthread_mutex_lock(&frame_lock);
+	cached = (f->positions != NULL);
+	pthread_mutex_unlock(&frame_lock);
+	if(cached)
+		return;
+
+	positions = aligned_malloc(sizeof(float) * 3 * f->num_vertices);
+	if(!positions)
+		return;
+	decode_frame(f, positions);
+
+	pthread_mutex_lock(&frame_lock);
+	insert_frame(f, positions);
+	trim_frame_cache();
+	pthread_mutex_unlock(&frame_lock);
+}
+
+/* decode a frame on the background thread, if it isn't cached already */
+void
+md2_prefetch_frame(struct md2_model *mp, unsigned int frame)
+{
+	struct frame_request *r;
+	int cached;
+
+	pthread_mutex_lock(&frame_lock);
+	cached = (mp->f[frame].positions != NULL);
+	pthread_mutex_unlock(&frame_lock);
+	if(cached)
+		return;
+
+	r = malloc(sizeof(struct frame_request));
+	if(!r)
+		return;
+	r->mp = mp;
+	r->frame = frame;
+	if(!threads_queue(prefetch_frame, r))
+		free(r);
+}
+
+/* drop all of a model's frames from the cache, once nothing can be decoding them */
 static void
-get_vertex_from_index(struct md2_model *mp, unsigned int frame,
-                      unsigned int index, float v[3])
+evict_model_frames(struct md2_model *mp)
+{
+	unsigned int i;
+
+	threads_flush_queue();
+
+	pthread_mutex_lock(&frame_lock);
+	for(i = 0; i < mp->num_frames; i++) {
+		if(mp->f[i].positions)
+			evict_frame(mp->f + i);
+	}
+	pthread_mutex_unlock(&frame_lock);
+}
+
+/* the pose's vertices are only the same if it's between the same frames */
+static int
+same_pose(struct md2_pose *pose, unsigned int frame, unsigned int next_frame,
+          float lerp)
 {
-	v[0] = (mp->f[frame].vertices[index].vertex[0] * mp->f[frame].scale[0] + mp->f[frame].translate[0]) * MD2_SCALE;
-	v[1] = (mp->f[frame].vertices[index].vertex[1] * mp->f[frame].scale[1] + mp->f[frame].translate[1]) * MD2_SCALE;
-	v[2] = (mp->f[frame].vertices[index].vertex[2] * mp->f[frame].scale[2] + mp->f[frame].translate[2]) * MD2_SCALE;
+	return (pose->frame == frame && pose->next_frame == next_frame &&
+	        pose->lerp == lerp);
 }
 
 static struct md2_tri_edge *
@@ -167,377 +497,2072 @@ get_edge_with_verts(struct md2_tri_edge *edges, unsigned int num_edges,
 	return NULL;
 }
 
+/* get a triangle's plane in model space, with a unit length normal */
 static void
-get_edge_order_from_invisible_tri(struct md2_model *mp,
-                                  struct md2_tri_edge *edge, unsigned int v[2])
+get_triangle_plane(struct md2_model *mp, float (*verts)[3], unsigned int tri,
+                   float plane[4])
 {
-	int n = 0;
-	struct md2_triangle *t;
-
-	if(mp->t_info[(edge->triangleIndices[0])].visible)
-		n = 1;
+	float len;
 
-	t = &(mp->t[(edge->triangleIndices[n])]);
+	setup_plane(plane, verts[(mp->t[tri].vertexIndices[2])], verts[(mp->t[tri].vertexIndices[1])], verts[(mp->t[tri].vertexIndices[0])], FALSE);
 
-	if((t->vertexIndices[0] == edge->vertexIndices[0] &&
-	    t->vertexIndices[1] == edge->vertexIndices[1]) ||
-	   (t->vertexIndices[0] == edge->vertexIndices[1] &&
-	    t->vertexIndices[1] == edge->vertexIndices[0])) {
-		v[0] = t->vertexIndices[0];
-		v[1] = t->vertexIndices[1];
-		return;
+	len = VEC_MAGNITUDE(plane);
+	if(len > 0.0f) {
+		plane[0] /= len;
+		plane[1] /= len;
+		plane[2] /= len;
+		plane[3] /= len;
 	}
+}
 
-	if((t->vertexIndices[1] == edge->vertexIndices[0] &&
-	    t->vertexIndices[2] == edge->vertexIndices[1]) ||
-	   (t->vertexIndices[1] == edge->vertexIndices[1] &&
-	    t->vertexIndices[2] == edge->vertexIndices[0])) {
-		v[0] = t->vertexIndices[1];
-		v[1] = t->vertexIndices[2];
-		return;
-	}
+static int
+compare_tri_dists(const void *a, const void *b)
+{
+	float d1 = ((const struct md2_tri_dist *)a)->dist;
+	float d2 = ((const struct md2_tri_dist *)b)->dist;
+
+	if(d1 < d2)
+		return -1;
+	if(d1 > d2)
+		return 1;
+	return 0;
+}
 
-	if((t->vertexIndices[2] == edge->vertexIndices[0] &&
-	    t->vertexIndices[0] == edge->vertexIndices[1]) ||
-	   (t->vertexIndices[2] == edge->vertexIndices[1] &&
-	    t->vertexIndices[0] == edge->vertexIndices[0])) {
-		v[0] = t->vertexIndices[2];
-		v[1] = t->vertexIndices[0];
-		return;
+/* add, update or remove an edge in the silhouette to match the facing bits */
+static void
+update_silhouette_edge(struct md2_model *mp, struct md2_shadow *sp,
+                       unsigned int e)
+{
+	uint32_t b0, b1;
+	unsigned int last;
+	int slot;
+
+	b0 = FACING(sp->facing, mp->edge_tris[e][0]);
+	b1 = FACING(sp->facing, mp->edge_tris[e][1]);
+	slot = sp->slots[e];
+
+	if(b0 ^ b1) {
+		if(slot == -1) {
+			slot = sp->num_silhouette_edges++;
+			sp->slots[e] = slot;
+		}
+		sp->silhouette[slot] = (e << 1) | b0;
+	} else if(slot != -1) {
+		last = sp->silhouette[--sp->num_silhouette_edges];
+		sp->silhouette[slot] = last;
+		sp->slots[(last >> 1)] = slot;
+		sp->slots[e] = -1;
 	}
 }
 
 /*
- * mark triangles that are visible from the specified point
+ * classify every triangle against the light, sort the triangles by how
+ * far their planes are from it, then collect the silhouette edges: those
+ * between a visible and an invisible triangle. the edges that were pruned
+ * for a keyframe may bend between keyframes, so a blended pose checks
+ * every edge
  */
-void
-md2_calculate_visible_tris(struct md2_model *mp, unsigned int frame,
-                           float model_pos[3], float model_rot[3],
-                           float p[3])
+static void
+classify_all_tris(struct md2_model *mp, struct md2_shadow *sp,
+                  struct md2_pose *pose, float l[3])
 {
-	unsigned int i;
+	unsigned short *edges;
+	unsigned int i, e, n, num_edges;
+	uint32_t b0, b1;
+	float plane[4], d;
+
+	if(pose->lerp == 0.0f) {
+		edges = mp->f[(pose->frame)].edges;
+		num_edges = mp->f[(pose->frame)].num_edges;
+	} else {
+		edges = NULL;
+		num_edges = mp->num_edges;
+	}
 
+	my_bzero(sp->facing, sizeof(uint32_t) * FACING_WORDS(mp->num_triangles));
 	for(i = 0; i < mp->num_triangles; i++) {
-		float v[3][3];
-		float plane[4];
+		get_triangle_plane(mp, pose->verts, i, plane);
+		d = dot_product(plane, l) + plane[3];
+		if(d > 0.0f)
+			sp->facing[i >> 5] |= 1u << (i & 31);
 
-		get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[0], v[0]);
-		transform_vertex(v[0], model_pos, model_rot);
-		get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[1], v[1]);
-		transform_vertex(v[1], model_pos, model_rot);
-		get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[2], v[2]);
-		transform_vertex(v[2], model_pos, model_rot);
+		sp->dists[i].dist = (d < 0.0f) ? -d : d;
+		sp->dists[i].tri = i;
+	}
+	qsort(sp->dists, mp->num_triangles, sizeof(struct md2_tri_dist), compare_tri_dists);
 
-		setup_plane(plane, v[2], v[1], v[0], FALSE);
-		if(dot_product(plane, p) + plane[3] > 0.0f)
-			mp->t_info[i].visible = 1;
-		else
-			mp->t_info[i].visible = 0;
+	my_bzero(sp->candidates, sizeof(uint32_t) * FACING_WORDS(mp->num_edges));
+	for(i = 0; i < num_edges; i++) {
+		e = edges ? edges[i] : i;
+		sp->candidates[e >> 5] |= 1u << (e & 31);
+	}
 
-		mp->t_info[i].drawn = 0;
+	/*
+	 * the edge's index is always stored, but the list only grows when the
+	 * facing bits differ; the low bit records whether the edge has to be
+	 * reversed to follow the winding of its invisible triangle
+	 */
+	for(i = 0; i < mp->num_edges; i++)
+		sp->slots[i] = -1;
+	n = 0;
+	for(i = 0; i < num_edges; i++) {
+		e = edges ? edges[i] : i;
+		b0 = FACING(sp->facing, mp->edge_tris[e][0]);
+		b1 = FACING(sp->facing, mp->edge_tris[e][1]);
+
+		sp->silhouette[n] = (e << 1) | b0;
+		if(b0 ^ b1)
+			sp->slots[e] = n;
+		n += b0 ^ b1;
 	}
+	sp->num_silhouette_edges = n;
+
+	sp->ref_light[0] = l[0];
+	sp->ref_light[1] = l[1];
+	sp->ref_light[2] = l[2];
+	sp->frame = pose->frame;
+	sp->next_frame = pose->next_frame;
+	sp->lerp = pose->lerp;
+	sp->valid = 1;
 }
 
+/*
+ * mark triangles that are visible from the specified point and update the
+ * silhouette. a triangle can only change sides once the light has moved
+ * further than the distance between the light and the triangle's plane,
+ * so as long as the pose stays the same only the triangles closest to
+ * the light are tested again, and only their edges are patched
+ */
 void
-md2_render_shadow_volume(struct md2_model *mp, unsigned int frame,
-                         float model_pos[3], float model_rot[3],
-                         float light_pos[3])
+md2_calculate_visible_tris(struct md2_model *mp, struct md2_shadow *sp,
+                           struct md2_pose *pose, float model_pos[3],
+                           float model_rot[3], float p[3])
 {
-	unsigned int i, j;
+	unsigned int i, j, lo, hi;
+	uint32_t bit;
+	float l[3], d[3], moved;
+	float plane[4];
+
+	l[0] = p[0];
+	l[1] = p[1];
+	l[2] = p[2];
+	untransform_vertex(l, model_pos, model_rot);
+
+	/* the state can be used with any of the model's shadow LODs, but not two at once */
+	if(sp->mp != mp) {
+		sp->mp = mp;
+		sp->valid = 0;
+		sp->built = 0;
+	}
 
-	glFrontFace(GL_CW);
+	if(!sp->valid || !same_pose(pose, sp->frame, sp->next_frame, sp->lerp)) {
+		classify_all_tris(mp, sp, pose, l);
+		return;
+	}
 
-	/* silhouette edges */
-	glBegin(GL_QUADS);
-	for(i = 0; i < mp->num_edges && mp->t_edges[i].taken; i++) {
-		struct md2_triangle *t[2];
-		struct md2_tri_info *t_info[2];
+	d[0] = l[0] - sp->ref_light[0];
+	d[1] = l[1] - sp->ref_light[1];
+	d[2] = l[2] - sp->ref_light[2];
+	moved = VEC_MAGNITUDE(d);
+
+	/* find how many triangles the light might have crossed */
+	lo = 0;
+	hi = mp->num_triangles;
+	while(lo < hi) {
+		i = (lo + hi) / 2;
+		if(sp->dists[i].dist <= moved)
+			lo = i + 1;
+		else
+			hi = i;
+	}
 
-		t[0] = mp->t + mp->t_edges[i].triangleIndices[0];
-		t[1] = mp->t + mp->t_edges[i].triangleIndices[1];
+	/* once that's a good part of the model, just start over */
+	if(lo > mp->num_triangles / 4) {
+		classify_all_tris(mp, sp, pose, l);
+		return;
+	}
 
-		t_info[0] = mp->t_info + mp->t_edges[i].triangleIndices[0];
-		t_info[1] = mp->t_info + mp->t_edges[i].triangleIndices[1];
+	for(i = 0; i < lo; i++) {
+		unsigned int t = sp->dists[i].tri;
 
-		if(t_info[0]->visible != t_info[1]->visible) {
-			float v[4][3];
-			float n[2][3];
-			unsigned int edge_v[2];
+		get_triangle_plane(mp, pose->verts, t, plane);
+		bit = (dot_product(plane, l) + plane[3] > 0.0f);
+		if(bit == FACING(sp->facing, t))
+			continue;
 
-			get_edge_order_from_invisible_tri(mp, mp->t_edges + i, edge_v);
+		sp->facing[t >> 5] ^= 1u << (t & 31);
+		for(j = 0; j < 3; j++) {
+			unsigned int e = mp->tri_edges[t][j];
+
+			if(FACING(sp->candidates, e))
+				update_silhouette_edge(mp, sp, e);
+		}
+	}
+}
 
-			get_vertex_from_index(mp, frame, edge_v[0], v[0]);
-			transform_vertex(v[0], model_pos, model_rot);
-			get_vertex_from_index(mp, frame, edge_v[1], v[1]);
-			transform_vertex(v[1], model_pos, model_rot);
+/*
+ * get a sphere, in world coordinates, that encloses every vertex of
+ * the given pose; the box spanned by a frame's scale and translation
+ * values always contains the frame's quantized vertices, and a blend of
+ * two frames stays within both of their boxes
+ */
+void
+md2_get_bounding_sphere(struct md2_model *mp, struct md2_pose *pose,
+                        float model_pos[3], float model_rot[3],
+                        float center[3], float *radius)
+{
+	struct md2_frame *f1 = mp->f + pose->frame;
+	struct md2_frame *f2 = mp->f + pose->next_frame;
+	float mins[3], maxs[3], half[3];
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		mins[i] = f1->translate[i];
+		maxs[i] = f1->translate[i] + f1->scale[i] * 255.0f;
+		if(f2->translate[i] < mins[i])
+			mins[i] = f2->translate[i];
+		if(f2->translate[i] + f2->scale[i] * 255.0f > maxs[i])
+			maxs[i] = f2->translate[i] + f2->scale[i] * 255.0f;
+
+		half[i] = (maxs[i] - mins[i]) * 0.5f * MD2_SCALE;
+		center[i] = mins[i] * MD2_SCALE + half[i];
+	}
+	transform_vertex(center, model_pos, model_rot);
 
-			n[0][0] = v[0][0] - light_pos[0];
-			n[0][1] = v[0][1] - light_pos[1];
-			n[0][2] = v[0][2] - light_pos[2];
-			normalize(n[0]);
+	*radius = VEC_MAGNITUDE(half);
+}
 
-			v[2][0] = v[0][0] + INFINITY * n[0][0];
-			v[2][1] = v[0][1] + INFINITY * n[0][1];
-			v[2][2] = v[0][2] + INFINITY * n[0][2];
+/*
+ * set the box that receives shadows; shadow volumes aren't extruded
+ * beyond it
+ */
+void
+md2_set_shadow_bounds(float mins[3], float maxs[3])
+{
+	shadow_mins[0] = mins[0];
+	shadow_mins[1] = mins[1];
+	shadow_mins[2] = mins[2];
 
-			n[1][0] = v[1][0] - light_pos[0];
-			n[1][1] = v[1][1] - light_pos[1];
-			n[1][2] = v[1][2] - light_pos[2];
-			normalize(n[1]);
+	shadow_maxs[0] = maxs[0];
+	shadow_maxs[1] = maxs[1];
+	shadow_maxs[2] = maxs[2];
 
-			v[3][0] = v[1][0] + INFINITY * n[1][0];
-			v[3][1] = v[1][1] + INFINITY * n[1][1];
-			v[3][2] = v[1][2] + INFINITY * n[1][2];
+	shadow_bounds_set = 1;
+}
 
-			glVertex3fv(v[3]);
-			glVertex3fv(v[1]);
-			glVertex3fv(v[0]);
-			glVertex3fv(v[2]);
+/*
+ * push a vertex away from the light, just far enough to leave both the
+ * light's radius and the shadow bounds
+ */
+static void
+extrude_vertex(float v[3], float light_pos[3], float light_radius)
+{
+	float n[3];
+	float dist, len, t;
+	int i;
+
+	n[0] = v[0] - light_pos[0];
+	n[1] = v[1] - light_pos[1];
+	n[2] = v[2] - light_pos[2];
+	dist = VEC_MAGNITUDE(n);
+	if(dist == 0.0f)
+		return;
+	n[0] /= dist;
+	n[1] /= dist;
+	n[2] /= dist;
+
+	len = light_radius - dist;
+	if(shadow_bounds_set) {
+		for(i = 0; i < 3; i++) {
+			if(n[i] > 0.0001f)
+				t = (shadow_maxs[i] - v[i]) / n[i];
+			else if(n[i] < -0.0001f)
+				t = (shadow_mins[i] - v[i]) / n[i];
+			else
+				continue;
+
+			if(t < len)
+				len = t;
 		}
 	}
-	glEnd();
+	if(len < 0.0f)
+		len = 0.0f;
+	len += SHADOW_EPSILON;
 
-	glFrontFace(GL_CCW);
-	glBegin(GL_TRIANGLES);
-	for(i = 0; i < mp->num_triangles; i++) {
-		if(mp->t_info[i].visible) { /* close cap */
-			float v[3][3];
+	v[0] += len * n[0];
+	v[1] += len * n[1];
+	v[2] += len * n[2];
+}
+
+/*
+ * allocate the state needed to track the silhouette of the model as seen
+ * from a single light, and the shadow volume built from it
+ */
+struct md2_shadow *
+md2_shadow_create(struct md2_model *mp)
+{
+	struct md2_shadow *sp;
+
+	sp = malloc(sizeof(struct md2_shadow));
+	if(!sp) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow\n");
+		return NULL;
+	}
+	my_bzero(sp, sizeof(struct md2_shadow));
+
+	sp->facing = aligned_malloc(sizeof(uint32_t) * FACING_WORDS(mp->num_triangles));
+	sp->dists = malloc(sizeof(struct md2_tri_dist) * mp->num_triangles);
+	sp->candidates = aligned_malloc(sizeof(uint32_t) * FACING_WORDS(mp->num_edges));
+	sp->silhouette = aligned_malloc(sizeof(unsigned int) * mp->num_edges);
+	sp->slots = malloc(sizeof(int) * mp->num_edges);
+	sp->verts = aligned_malloc(sizeof(float) * 3 * (mp->num_edges * 4 + mp->num_triangles * 3));
+	if(!sp->facing || !sp->dists || !sp->candidates || !sp->silhouette ||
+	   !sp->slots || !sp->verts) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow\n");
+		md2_shadow_free(sp);
+		return NULL;
+	}
+
+	return sp;
+}
 
-			get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[0], v[0]);
-			transform_vertex(v[0], model_pos, model_rot);
+void
+md2_shadow_free(struct md2_shadow *sp)
+{
+	if(!sp)
+		return;
+
+	if(sp->facing)
+		free(sp->facing);
+	if(sp->dists)
+		free(sp->dists);
+	if(sp->candidates)
+		free(sp->candidates);
+	if(sp->silhouette)
+		free(sp->silhouette);
+	if(sp->slots)
+		free(sp->slots);
+	if(sp->verts)
+		free(sp->verts);
+	free(sp);
+}
+
+/*
+ * build the shadow volume for the current silhouette; the caps are only
+ * needed when the volume is rendered with the depth-fail technique, so
+ * they're skipped when caps is FALSE. if nothing has changed since the
+ * volume was last built, it's used as it is
+ */
+void
+md2_build_shadow_volume(struct md2_model *mp, struct md2_shadow *sp,
+                        struct md2_pose *pose, float model_pos[3],
+                        float model_rot[3], float light_pos[3],
+                        float light_radius, int caps)
+{
+	float key[13];
+	float (*v)[3];
+	unsigned int i, j;
 
-			get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[1], v[1]);
-			transform_vertex(v[1], model_pos, model_rot);
+	key[0] = model_pos[0];
+	key[1] = model_pos[1];
+	key[2] = model_pos[2];
+	key[3] = model_rot[0];
+	key[4] = model_rot[1];
+	key[5] = model_rot[2];
+	key[6] = light_pos[0];
+	key[7] = light_pos[1];
+	key[8] = light_pos[2];
+	key[9] = light_radius;
+	key[10] = (float)pose->frame;
+	key[11] = (float)pose->next_frame;
+	key[12] = pose->lerp;
+	if(sp->built && (sp->has_caps || !caps) &&
+	   memcmp(key, sp->key, sizeof(key)) == 0)
+		return;
 
-			get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[2], v[2]);
-			transform_vertex(v[2], model_pos, model_rot);
+	/* silhouette edges */
+	v = sp->verts;
+	for(i = 0; i < sp->num_silhouette_edges; i++) {
+		unsigned int e = sp->silhouette[i] >> 1;
+		unsigned int reversed = sp->silhouette[i] & 1;
 
-			glVertex3fv(v[0]);
-			glVertex3fv(v[1]);
-			glVertex3fv(v[2]);
-		} else { /* far cap */
-			float v[3][3];
-			float n[3];
+		memcpy(v[2], pose->verts[(mp->edge_verts[e][reversed])], sizeof(float) * 3);
+		transform_vertex(v[2], model_pos, model_rot);
+		memcpy(v[1], pose->verts[(mp->edge_verts[e][reversed ^ 1])], sizeof(float) * 3);
+		transform_vertex(v[1], model_pos, model_rot);
 
-			get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[0], v[0]);
-			transform_vertex(v[0], model_pos, model_rot);
+		v[3][0] = v[2][0];
+		v[3][1] = v[2][1];
+		v[3][2] = v[2][2];
+		extrude_vertex(v[3], light_pos, light_radius);
 
-			get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[1], v[1]);
-			transform_vertex(v[1], model_pos, model_rot);
+		v[0][0] = v[1][0];
+		v[0][1] = v[1][1];
+		v[0][2] = v[1][2];
+		extrude_vertex(v[0], light_pos, light_radius);
 
-			get_vertex_from_index(mp, frame, mp->t[i].vertexIndices[2], v[2]);
-			transform_vertex(v[2], model_pos, model_rot);
+		v += 4;
+	}
+	sp->num_quad_verts = v - sp->verts;
 
+	sp->num_cap_verts = 0;
+	if(caps) {
+		for(i = 0; i < mp->num_triangles; i++) {
 			for(j = 0; j < 3; j++) {
-				n[0] = v[j][0] - light_pos[0];
-				n[1] = v[j][1] - light_pos[1];
-				n[2] = v[j][2] - light_pos[2];
-				normalize(n);
-
-				v[j][0] += INFINITY * n[0];
-				v[j][1] += INFINITY * n[1];
-				v[j][2] += INFINITY * n[2];
+				memcpy(v[j], pose->verts[(mp->t[i].vertexIndices[j])], sizeof(float) * 3);
+				transform_vertex(v[j], model_pos, model_rot);
 			}
 
-			glVertex3fv(v[0]);
-			glVertex3fv(v[1]);
-			glVertex3fv(v[2]);
+			/* visible triangles close the volume, the rest are the far cap */
+			if(!FACING(sp->facing, i)) {
+				for(j = 0; j < 3; j++)
+					extrude_vertex(v[j], light_pos, light_radius);
+			}
+
+			v += 3;
 		}
+		sp->num_cap_verts = (v - sp->verts) - sp->num_quad_verts;
 	}
-	glEnd();
 
-	glFrontFace(GL_CCW);
+	memcpy(sp->key, key, sizeof(key));
+	sp->has_caps = caps;
+	sp->built = 1;
 }
 
+/* render the shadow volume last built by md2_build_shadow_volume() */
 void
-md2_render(struct md2_model *mp, unsigned int frame)
+md2_render_shadow_volume(struct md2_shadow *sp, int caps)
 {
-	int i, j;
-
-	if(!mp || frame > mp->num_frames)
+	if(!sp->built)
 		return;
 
-	glPushMatrix();
-	glTranslatef(mp->f[frame].translate[0] * MD2_SCALE, mp->f[frame].translate[1] * MD2_SCALE, mp->f[frame].translate[2] * MD2_SCALE);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, sp->verts);
+
+	glFrontFace(GL_CW);
+	glDrawArrays(GL_QUADS, 0, sp->num_quad_verts);
+	glFrontFace(GL_CCW);
+	if(caps && sp->num_cap_verts)
+		glDrawArrays(GL_TRIANGLES, sp->num_quad_verts, sp->num_cap_verts);
 
-	for(i = 0; i < mp->num_glcommands; i++) {
-		glBegin((mp->g[i].type ? GL_TRIANGLE_FAN : GL_TRIANGLE_STRIP));
-		for(j = 0; j < mp->g[i].num_vertices; j++) {
-			float v[3];
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-			v[0] = mp->f[frame].vertices[(mp->g[i].vertices[j].vertexIndex)].vertex[0] * mp->f[frame].scale[0] * MD2_SCALE;
-			v[1] = mp->f[frame].vertices[(mp->g[i].vertices[j].vertexIndex)].vertex[1] * mp->f[frame].scale[1] * MD2_SCALE;
-			v[2] = mp->f[frame].vertices[(mp->g[i].vertices[j].vertexIndex)].vertex[2] * mp->f[frame].scale[2] * MD2_SCALE;
+/*
+ * compile the program used by md2_render_shadow_volume_gpu(); returns
+ * FALSE if shaders aren't supported
+ */
+int
+md2_init_shadow_shader()
+{
+	if(shadow_program)
+		return TRUE;
 
-			glTexCoord2f(mp->g[i].vertices[j].s, mp->g[i].vertices[j].t);
-			glVertex3fv(v);
-		}
-		glEnd();
-	}
+	shadow_program = create_shader_program(shadow_vertex_src, NULL, shadow_attribs);
+	if(!shadow_program)
+		return FALSE;
 
-	glPopMatrix();
+	shadow_light_uniform = glGetUniformLocation(shadow_program, "light");
+	return TRUE;
 }
 
 static void
-my_bzero(void *p, unsigned int size)
+set_shadow_vertex(struct shadow_vertex *sv, float v[3], float plane[4])
 {
-	unsigned int i;
-
-	for(i = 0; i < size; i++)
-		((int8_t *)p)[i] = 0;
+	sv->v[0] = v[0];
+	sv->v[1] = v[1];
+	sv->v[2] = v[2];
+	sv->plane[0] = plane[0];
+	sv->plane[1] = plane[1];
+	sv->plane[2] = plane[2];
+	sv->plane[3] = plane[3];
 }
 
-struct md2_model *
-md2_load(const char *filename)
+/*
+ * build the shadow mesh of a pose in model space and upload it to the
+ * given buffer object: a quad for each edge, followed by the triangles.
+ * if edges is NULL, every edge of the model gets a quad
+ */
+static int
+build_shadow_mesh(struct md2_model *mp, float (*pose_verts)[3],
+                  unsigned short *edges, unsigned int num_edges,
+                  unsigned int buffer, GLenum usage)
 {
-	unsigned int i, j;
-	FILE *fp;
-	struct md2_header m;
-	struct md2_model *mp;
-
-	mp = malloc(sizeof(struct md2_model));
-	if(!mp) {
-		fprintf(stderr, "Error: Couldn't allocate memory for md2 model\n");
-		return NULL;
+	struct shadow_vertex *verts, *sv;
+	float (*planes)[4];
+	unsigned int i, size;
+
+	planes = malloc(sizeof(float) * 4 * mp->num_triangles);
+	if(!planes) {
+		fprintf(stderr, "Error: Couldn't allocate memory for triangle planes\n");
+		return FALSE;
 	}
-	snprintf(mp->name, 128, "%s", filename);
 
-	fp = fopen(filename, "rb");
-	if(!fp) {
-		fprintf(stderr, "Error: Can't open %s\n", filename);
-		return NULL;
+	for(i = 0; i < mp->num_triangles; i++)
+		setup_plane(planes[i], pose_verts[(mp->t[i].vertexIndices[2])], pose_verts[(mp->t[i].vertexIndices[1])], pose_verts[(mp->t[i].vertexIndices[0])], FALSE);
+
+	size = sizeof(struct shadow_vertex) * (num_edges * 4 + mp->num_triangles * 3);
+	verts = malloc(size);
+	if(!verts) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow mesh\n");
+		free(planes);
+		return FALSE;
 	}
 
-	fread(&m, sizeof(struct md2_header), 1, fp);
-	for(i = 0; i < sizeof(struct md2_header) / sizeof(int); i++) {
-		int32_t *p = (int32_t *)&m.magic;
+	/*
+	 * the edge's vertices are in the order of its first triangle; this
+	 * order makes the quad face outwards whichever of the two triangles
+	 * ends up facing the light
+	 */
+	sv = verts;
+	for(i = 0; i < num_edges; i++) {
+		unsigned int e = edges ? edges[i] : i;
+		unsigned short *ev = mp->edge_verts[e];
+		unsigned short *et = mp->edge_tris[e];
+
+		set_shadow_vertex(sv++, pose_verts[(ev[0])], planes[(et[1])]);
+		set_shadow_vertex(sv++, pose_verts[(ev[0])], planes[(et[0])]);
+		set_shadow_vertex(sv++, pose_verts[(ev[1])], planes[(et[0])]);
+		set_shadow_vertex(sv++, pose_verts[(ev[1])], planes[(et[1])]);
+	}
 
-		p += i;
-		*p = le_to_native_int(*p);
+	for(i = 0; i < mp->num_triangles; i++) {
+		set_shadow_vertex(sv++, pose_verts[(mp->t[i].vertexIndices[0])], planes[i]);
+		set_shadow_vertex(sv++, pose_verts[(mp->t[i].vertexIndices[1])], planes[i]);
+		set_shadow_vertex(sv++, pose_verts[(mp->t[i].vertexIndices[2])], planes[i]);
 	}
 
-	/* load frames */
-	mp->f = malloc(sizeof(struct md2_frame) * m.numFrames);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, size, verts, usage);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	free(verts);
+	free(planes);
+	return TRUE;
+}
+
+/*
+ * render the shadow volume with the extrusion done by a vertex shader.
+ * a keyframe's mesh is uploaded the first time it's used; a blended pose
+ * gets its own mesh, which is rebuilt whenever the pose changes. after
+ * that, the only per-light work on the CPU is moving the light into
+ * model space
+ */
+void
+md2_render_shadow_volume_gpu(struct md2_model *mp, struct md2_pose *pose,
+                             float model_pos[3], float model_rot[3],
+                             float light_pos[3], int caps)
+{
+	struct md2_frame *f = mp->f + pose->frame;
+	struct md2_model *vmp = mp->parent ? mp->parent : mp;
+	unsigned int buffer, num_edges;
+	float l[3];
+
+	if(!shadow_program || pose->frame >= mp->num_frames)
+		return;
+
+	if(pose->lerp == 0.0f) {
+		if(!mp->shadow_buffers[(pose->frame)]) {
+			if(!md2_get_frame(vmp, pose->frame))
+				return;
+			glGenBuffers(1, &(mp->shadow_buffers[(pose->frame)]));
+			if(!build_shadow_mesh(mp, vmp->f[(pose->frame)].positions, f->edges, f->num_edges, mp->shadow_buffers[(pose->frame)], GL_STATIC_DRAW)) {
+				md2_release_frame(vmp, pose->frame);
+				return;
+			}
+			md2_release_frame(vmp, pose->frame);
+		}
+		buffer = mp->shadow_buffers[(pose->frame)];
+		num_edges = f->num_edges;
+	} else {
+		if(!pose->shadow_buffer)
+			glGenBuffers(1, &(pose->shadow_buffer));
+		if(pose->shadow_mp != mp ||
+		   !same_pose(pose, pose->shadow_frame, pose->shadow_next_frame, pose->shadow_lerp)) {
+			if(!build_shadow_mesh(mp, pose->verts, NULL, mp->num_edges, pose->shadow_buffer, GL_STREAM_DRAW))
+				return;
+			pose->shadow_mp = mp;
+			pose->shadow_frame = pose->frame;
+			pose->shadow_next_frame = pose->next_frame;
+			pose->shadow_lerp = pose->lerp;
+		}
+		buffer = pose->shadow_buffer;
+		num_edges = mp->num_edges;
+	}
+
+	l[0] = light_pos[0];
+	l[1] = light_pos[1];
+	l[2] = light_pos[2];
+	untransform_vertex(l, model_pos, model_rot);
+
+	glPushMatrix();
+	glTranslatef(model_pos[0], model_pos[1], model_pos[2]);
+	glRotatef(model_rot[2], 0.0f, 0.0f, -1.0f);
+	glRotatef(model_rot[1], 0.0f, 1.0f, 0.0f);
+	glRotatef(model_rot[0], 1.0f, 0.0f, 0.0f);
+
+	glUseProgram(shadow_program);
+	glUniform3fv(shadow_light_uniform, 1, l);
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(struct shadow_vertex), (void *)offsetof(struct shadow_vertex, v));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct shadow_vertex), (void *)offsetof(struct shadow_vertex, plane));
+
+	glFrontFace(GL_CW);
+	glDrawArrays(GL_QUADS, 0, num_edges * 4);
+	glFrontFace(GL_CCW);
+	if(caps)
+		glDrawArrays(GL_TRIANGLES, num_edges * 4, mp->num_triangles * 3);
+
+	glDisableVertexAttribArray(1);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+
+	glPopMatrix();
+}
+
+static int
+setup_render_buffers(struct md2_model *mp)
+{
+	float (*positions)[3], (*frame)[3];
+	unsigned int i, j, size;
+
+	/* every frame is decoded straight into the buffer, bypassing the frame cache */
+	size = sizeof(float) * 3 * mp->num_render_verts;
+	positions = malloc(size * mp->num_frames);
+	frame = malloc(sizeof(float) * 3 * mp->num_vertices);
+	if(!positions || !frame) {
+		fprintf(stderr, "Error: Couldn't allocate memory for vertex positions\n");
+		free(positions);
+		free(frame);
+		return FALSE;
+	}
+
+	for(i = 0; i < mp->num_frames; i++) {
+		decode_frame(mp->f + i, frame);
+		for(j = 0; j < mp->num_render_verts; j++) {
+			positions[i * mp->num_render_verts + j][0] = frame[(mp->render_verts[j])][0];
+			positions[i * mp->num_render_verts + j][1] = frame[(mp->render_verts[j])][1];
+			positions[i * mp->num_render_verts + j][2] = frame[(mp->render_verts[j])][2];
+		}
+	}
+	free(frame);
+
+	glGenBuffers(3, mp->render_buffers);
+	glGenBuffers(1, &(mp->stream_buffer));
+	glGenBuffers(1, &(mp->color_buffer));
+	glBindBuffer(GL_ARRAY_BUFFER, mp->render_buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, size * mp->num_frames, positions, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, mp->render_buffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * mp->num_render_verts, mp->texcoords, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mp->render_buffers[2]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * mp->num_indices, mp->indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	free(positions);
+	return TRUE;
+}
+
+/*
+ * draw the pose from buffer objects with a single call; the positions of
+ * every keyframe are in one buffer, so a keyframe only moves the pointer.
+ * a blended pose is gathered into the stream buffer first
+ */
+static void
+render_buffers(struct md2_model *mp, struct md2_pose *pose)
+{
+	float (*positions)[3];
+	unsigned char (*colors)[4];
+	unsigned int i;
+
+	if(pose->lerp == 0.0f) {
+		glBindBuffer(GL_ARRAY_BUFFER, mp->render_buffers[0]);
+		glVertexPointer(3, GL_FLOAT, 0, (void *)(sizeof(float) * 3 * mp->num_render_verts * pose->frame));
+	} else {
+		glBindBuffer(GL_ARRAY_BUFFER, mp->stream_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * mp->num_render_verts, NULL, GL_STREAM_DRAW);
+		positions = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+		if(!positions) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+		for(i = 0; i < mp->num_render_verts; i++) {
+			positions[i][0] = pose->verts[(mp->render_verts[i])][0];
+			positions[i][1] = pose->verts[(mp->render_verts[i])][1];
+			positions[i][2] = pose->verts[(mp->render_verts[i])][2];
+		}
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glVertexPointer(3, GL_FLOAT, 0, (void *)0);
+	}
+	glEnableClientState(GL_VERTEX_ARRAY);
+
+	if(pose->colors) {
+		glBindBuffer(GL_ARRAY_BUFFER, mp->color_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(unsigned char) * 4 * mp->num_render_verts, NULL, GL_STREAM_DRAW);
+		colors = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+		if(colors) {
+			for(i = 0; i < mp->num_render_verts; i++)
+				memcpy(colors[i], pose->colors[(mp->render_verts[i])], 4);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glColorPointer(4, GL_UNSIGNED_BYTE, 0, (void *)0);
+			glEnableClientState(GL_COLOR_ARRAY);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, mp->render_buffers[1]);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, 0, (void *)0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mp->render_buffers[2]);
+
+	glDrawElements(GL_TRIANGLES, mp->num_indices, GL_UNSIGNED_SHORT, (void *)0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/* returns the vertices of the glcommand at *cmd and moves past it, or NULL at the end */
+static struct md2_glcommand_vertex *
+get_glcommand(int32_t **cmd, int *fan, int *num)
+{
+	struct md2_glcommand_vertex *gv;
+
+	if(!*cmd || **cmd == 0)
+		return NULL;
+
+	*num = **cmd;
+	*fan = (*num < 0);
+	if(*fan)
+		*num = -*num;
+	gv = (struct md2_glcommand_vertex *)(*cmd + 1);
+	*cmd += 1 + *num * 3;
+
+	return gv;
+}
+
+void
+md2_render(struct md2_model *mp, struct md2_pose *pose)
+{
+	struct md2_glcommand_vertex *gv;
+	int32_t *cmd;
+	int i, fan, num;
+
+	if(!mp || !pose->verts)
+		return;
+
+	if(mp->num_indices && buffers_supported()) {
+		if(mp->render_buffers[0] || setup_render_buffers(mp)) {
+			render_buffers(mp, pose);
+			return;
+		}
+	}
+
+	cmd = mp->glcommands;
+	while((gv = get_glcommand(&cmd, &fan, &num)) != NULL) {
+		glBegin((fan ? GL_TRIANGLE_FAN : GL_TRIANGLE_STRIP));
+		for(i = 0; i < num; i++) {
+			if(pose->colors)
+				glColor4ubv(pose->colors[(gv[i].vertexIndex)]);
+			glTexCoord2f(gv[i].s, gv[i].t);
+			glVertex3fv(pose->verts[(gv[i].vertexIndex)]);
+		}
+		glEnd();
+	}
+}
+
+/*
+ * find each triangle's neighbours, then store the edges as separate arrays
+ * of vertex pairs (in the order of the edge's first triangle) and triangle
+ * pairs, so that the silhouette loop only touches what it needs
+ */
+static int
+setup_edges(struct md2_model *mp)
+{
+	struct md2_tri_edge *edges;
+	unsigned int i, j, num_edges;
+
+	num_edges = mp->num_triangles * 3;
+	edges = malloc(sizeof(struct md2_tri_edge) * num_edges);
+	if(!edges) {
+		fprintf(stderr, "Error: Couldn't allocate memory for triangle edges\n");
+		return FALSE;
+	}
+	my_bzero(edges, sizeof(struct md2_tri_edge) * num_edges);
+
+	mp->tri_edges = malloc(sizeof(unsigned short) * 3 * mp->num_triangles);
+	if(!mp->tri_edges) {
+		fprintf(stderr, "Error: Couldn't allocate memory for triangle edges\n");
+		free(edges);
+		return FALSE;
+	}
+
+	for(i = 0; i < mp->num_triangles; i++) {
+		for(j = 0; j < 3; j++) {
+			struct md2_tri_edge *edge;
+
+			edge = get_edge_with_verts(edges, num_edges, mp->t[i].vertexIndices[j], mp->t[i].vertexIndices[(j + 1) % 3]);
+			if(edge->new_tri)
+				edge->triangleIndices[0] = i;
+			else
+				edge->triangleIndices[1] = i;
+
+			mp->tri_edges[i][j] = edge - edges;
+		}
+	}
+	for(mp->num_edges = 0; mp->num_edges < num_edges && edges[mp->num_edges].taken; mp->num_edges++);
+
+	mp->edge_verts = aligned_malloc(sizeof(unsigned short) * 2 * mp->num_edges);
+	mp->edge_tris = aligned_malloc(sizeof(unsigned short) * 2 * mp->num_edges);
+	if(!mp->edge_verts || !mp->edge_tris) {
+		fprintf(stderr, "Error: Couldn't allocate memory for triangle edges\n");
+		free(edges);
+		return FALSE;
+	}
+	for(i = 0; i < mp->num_edges; i++) {
+		mp->edge_verts[i][0] = edges[i].vertexIndices[0];
+		mp->edge_verts[i][1] = edges[i].vertexIndices[1];
+		mp->edge_tris[i][0] = edges[i].triangleIndices[0];
+		mp->edge_tris[i][1] = edges[i].triangleIndices[1];
+	}
+
+	free(edges);
+	return TRUE;
+}
+
+/*
+ * find the edges that can be on a frame's silhouette: an edge between two
+ * faces that lie in the same plane never can be, so it's left out of the
+ * list of edges tested in that frame. this sets up frame i; it only
+ * touches that frame, so the frames are set up in parallel. if memory
+ * runs out the frame's edges are left NULL
+ */
+static void
+setup_frame(void *data, unsigned int i)
+{
+	struct md2_model *mp = data;
+	struct md2_frame *f = mp->f + i;
+	struct md2_frame *vf = (mp->parent ? mp->parent->f : mp->f) + i;
+	float (*positions)[3], (*normals)[3];
+	float len;
+	unsigned int j;
+
+	f->edges = aligned_malloc(sizeof(unsigned short) * mp->num_edges);
+	positions = malloc(sizeof(float) * 3 * mp->num_vertices);
+	normals = malloc(sizeof(float) * 3 * mp->num_triangles);
+	if(!f->edges || !positions || !normals) {
+		free(f->edges);
+		f->edges = NULL;
+		free(positions);
+		free(normals);
+		return;
+	}
+
+	decode_frame(vf, positions);
+
+	for(j = 0; j < mp->num_triangles; j++) {
+		float plane[4];
+
+		setup_plane(plane, positions[(mp->t[j].vertexIndices[2])], positions[(mp->t[j].vertexIndices[1])], positions[(mp->t[j].vertexIndices[0])], FALSE);
+
+		/*
+		 * a face with no area has no direction, so its edges are always
+		 * tested. it's kept rather than dropped like an index-degenerate
+		 * one: its three edges pair up with its neighbours, and without
+		 * it they'd be open and the mesh no longer closed
+		 */
+		len = VEC_MAGNITUDE(plane);
+		if(len > 0.0f) {
+			normals[j][0] = plane[0] / len;
+			normals[j][1] = plane[1] / len;
+			normals[j][2] = plane[2] / len;
+		} else {
+			normals[j][0] = normals[j][1] = normals[j][2] = 0.0f;
+		}
+	}
+
+	f->num_edges = 0;
+	for(j = 0; j < mp->num_edges; j++) {
+		if(dot_product(normals[(mp->edge_tris[j][0])], normals[(mp->edge_tris[j][1])]) > 1.0f - COPLANAR_EPSILON)
+			continue;
+
+		f->edges[f->num_edges++] = j;
+	}
+
+	free(positions);
+	free(normals);
+}
+
+#define VCACHE_SIZE 32
+
+/*
+ * score a vertex by how recently it was used and how many triangles still
+ * need it, following Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+ */
+static float
+vertex_cache_score(int cache_pos, unsigned int remaining)
+{
+	float score = 0.0f;
+
+	if(remaining == 0)
+		return -1.0f;
+
+	if(cache_pos >= 0) {
+		/* the last triangle's vertices get a fixed score */
+		if(cache_pos < 3) {
+			score = 0.75f;
+		} else {
+			score = 1.0f - (float)(cache_pos - 3) / (float)(VCACHE_SIZE - 3);
+			score = score * sqrtf(score);
+		}
+	}
+
+	/* vertices with few triangles left are preferred, to get rid of them */
+	return score + 2.0f / sqrtf((float)remaining);
+}
+
+/* count the vertices a cache of VCACHE_SIZE would have to transform */
+static unsigned int
+count_cache_misses(unsigned short *indices, unsigned int num_indices)
+{
+	unsigned short cache[VCACHE_SIZE];
+	unsigned int i, j, len, misses;
+
+	len = misses = 0;
+	for(i = 0; i < num_indices; i++) {
+		for(j = 0; j < len; j++) {
+			if(cache[j] == indices[i])
+				break;
+		}
+		if(j < len)
+			continue;
+
+		misses++;
+		if(len < VCACHE_SIZE)
+			len++;
+		memmove(cache + 1, cache, sizeof(unsigned short) * (len - 1));
+		cache[0] = indices[i];
+	}
+
+	return misses;
+}
+
+/*
+ * reorder the triangles in indices so that vertices are reused while
+ * they're still in the post-transform cache; strips that were already
+ * good are left alone
+ */
+static int
+optimize_vertex_cache(unsigned short *indices, unsigned int num_tris,
+                      unsigned int num_verts)
+{
+	unsigned int *offsets, *remaining, *vert_tris;
+	int *cache_pos;
+	float *vert_scores, *tri_scores;
+	char *added;
+	unsigned short *out;
+	int cache[VCACHE_SIZE + 3], new_cache[VCACHE_SIZE + 3];
+	unsigned int cache_len, new_len;
+	unsigned int i, j, k, n, cursor;
+	int best;
+
+	offsets = malloc(sizeof(unsigned int) * (num_verts + 1));
+	remaining = malloc(sizeof(unsigned int) * num_verts);
+	vert_tris = malloc(sizeof(unsigned int) * num_tris * 3);
+	cache_pos = malloc(sizeof(int) * num_verts);
+	vert_scores = malloc(sizeof(float) * num_verts);
+	tri_scores = malloc(sizeof(float) * num_tris);
+	added = malloc(num_tris);
+	out = malloc(sizeof(unsigned short) * num_tris * 3);
+	if(!offsets || !remaining || !vert_tris || !cache_pos || !vert_scores ||
+	   !tri_scores || !added || !out) {
+		fprintf(stderr, "Error: Couldn't allocate memory for vertex cache optimization\n");
+		free(offsets);
+		free(remaining);
+		free(vert_tris);
+		free(cache_pos);
+		free(vert_scores);
+		free(tri_scores);
+		free(added);
+		free(out);
+		return FALSE;
+	}
+
+	/* list the triangles using each vertex */
+	for(i = 0; i < num_verts; i++)
+		remaining[i] = 0;
+	for(i = 0; i < num_tris * 3; i++)
+		remaining[(indices[i])]++;
+	offsets[0] = 0;
+	for(i = 0; i < num_verts; i++)
+		offsets[i + 1] = offsets[i] + remaining[i];
+	for(i = 0; i < num_verts; i++)
+		remaining[i] = 0;
+	for(i = 0; i < num_tris * 3; i++) {
+		unsigned int v = indices[i];
+
+		vert_tris[offsets[v] + remaining[v]++] = i / 3;
+	}
+
+	for(i = 0; i < num_verts; i++) {
+		cache_pos[i] = -1;
+		vert_scores[i] = vertex_cache_score(-1, remaining[i]);
+	}
+	for(i = 0; i < num_tris; i++) {
+		added[i] = 0;
+		tri_scores[i] = vert_scores[(indices[i * 3])] + vert_scores[(indices[i * 3 + 1])] + vert_scores[(indices[i * 3 + 2])];
+	}
+
+	cache_len = 0;
+	cursor = 0;
+	for(n = 0; n < num_tris; n++) {
+		/* pick the best triangle using a vertex in the cache... */
+		best = -1;
+		for(i = 0; i < cache_len; i++) {
+			unsigned int v = cache[i];
+
+			for(j = 0; j < remaining[v]; j++) {
+				unsigned int t = vert_tris[offsets[v] + j];
+
+				if(best == -1 || tri_scores[t] > tri_scores[best])
+					best = t;
+			}
+		}
+
+		/* ... or else the next one that hasn't been added yet */
+		if(best == -1) {
+			while(added[cursor])
+				cursor++;
+			best = cursor;
+		}
+
+		added[best] = 1;
+		out[n * 3] = indices[best * 3];
+		out[n * 3 + 1] = indices[best * 3 + 1];
+		out[n * 3 + 2] = indices[best * 3 + 2];
+
+		/* the triangle's vertices go to the front of the cache */
+		new_len = 0;
+		for(i = 0; i < 3; i++) {
+			unsigned int v = indices[best * 3 + i];
+
+			for(j = 0; j < remaining[v]; j++) {
+				if(vert_tris[offsets[v] + j] == (unsigned int)best) {
+					vert_tris[offsets[v] + j] = vert_tris[offsets[v] + remaining[v] - 1];
+					remaining[v]--;
+					break;
+				}
+			}
+			new_cache[new_len++] = v;
+		}
+		for(i = 0; i < cache_len; i++) {
+			if(cache[i] != new_cache[0] && cache[i] != new_cache[1] &&
+			   cache[i] != new_cache[2])
+				new_cache[new_len++] = cache[i];
+		}
+
+		/* rescore everything that was or is in the cache */
+		for(i = 0; i < new_len; i++) {
+			unsigned int v = new_cache[i];
+
+			cache_pos[v] = (i < VCACHE_SIZE) ? (int)i : -1;
+			vert_scores[v] = vertex_cache_score(cache_pos[v], remaining[v]);
+		}
+		for(i = 0; i < new_len; i++) {
+			unsigned int v = new_cache[i];
+
+			for(j = 0; j < remaining[v]; j++) {
+				unsigned int t = vert_tris[offsets[v] + j];
+
+				tri_scores[t] = 0.0f;
+				for(k = 0; k < 3; k++)
+					tri_scores[t] += vert_scores[(indices[t * 3 + k])];
+			}
+		}
+
+		cache_len = (new_len < VCACHE_SIZE) ? new_len : VCACHE_SIZE;
+		for(i = 0; i < cache_len; i++)
+			cache[i] = new_cache[i];
+	}
+
+	if(count_cache_misses(out, num_tris * 3) < count_cache_misses(indices, num_tris * 3))
+		memcpy(indices, out, sizeof(unsigned short) * num_tris * 3);
+
+	free(offsets);
+	free(remaining);
+	free(vert_tris);
+	free(cache_pos);
+	free(vert_scores);
+	free(tri_scores);
+	free(added);
+	free(out);
+	return TRUE;
+}
+
+/* add a glcommand vertex to the render vertices, unless it's already there */
+static unsigned short
+get_render_vertex(struct md2_model *mp, int *first, int *next,
+                  struct md2_glcommand_vertex *gv)
+{
+	int i;
+
+	for(i = first[(gv->vertexIndex)]; i != -1; i = next[i]) {
+		if(mp->texcoords[i][0] == gv->s && mp->texcoords[i][1] == gv->t)
+			return i;
+	}
+
+	i = mp->num_render_verts++;
+	mp->render_verts[i] = gv->vertexIndex;
+	mp->texcoords[i][0] = gv->s;
+	mp->texcoords[i][1] = gv->t;
+	next[i] = first[(gv->vertexIndex)];
+	first[(gv->vertexIndex)] = i;
+
+	return i;
+}
+
+/*
+ * turn the strips and fans of the glcommands into a single indexed
+ * triangle list; vertices sharing a position and texture coordinates are
+ * merged, the triangles are reordered for the vertex cache, and the
+ * vertices are then renumbered in the order they're first used
+ */
+static int
+setup_render_mesh(struct md2_model *mp, unsigned int num_vertices)
+{
+	struct md2_glcommand_vertex *gv;
+	int32_t *cmd;
+	unsigned short *remap, *verts;
+	float (*texcoords)[2];
+	int *first, *next;
+	unsigned int i, j, max_verts, max_indices;
+	int fan, num;
+
+	mp->render_verts = NULL;
+	mp->texcoords = NULL;
+	mp->indices = NULL;
+	mp->num_render_verts = 0;
+	mp->num_indices = 0;
+	mp->render_buffers[0] = mp->render_buffers[1] = mp->render_buffers[2] = 0;
+	mp->stream_buffer = 0;
+
+	max_verts = max_indices = 0;
+	cmd = mp->glcommands;
+	while((gv = get_glcommand(&cmd, &fan, &num)) != NULL) {
+		max_verts += num;
+		if(num >= 3)
+			max_indices += (num - 2) * 3;
+	}
+	/* models too big for short indices are left to the glcommands */
+	if(max_indices == 0 || max_verts >= 0xffff)
+		return TRUE;
+
+	mp->render_verts = malloc(sizeof(unsigned short) * max_verts);
+	mp->texcoords = malloc(sizeof(float) * 2 * max_verts);
+	mp->indices = malloc(sizeof(unsigned short) * max_indices);
+	first = malloc(sizeof(int) * num_vertices);
+	next = malloc(sizeof(int) * max_verts);
+	remap = malloc(sizeof(unsigned short) * max_verts);
+	if(!mp->render_verts || !mp->texcoords || !mp->indices || !first ||
+	   !next || !remap) {
+		fprintf(stderr, "Error: Couldn't allocate memory for render mesh\n");
+		free(first);
+		free(next);
+		free(remap);
+		return FALSE;
+	}
+
+	for(i = 0; i < num_vertices; i++)
+		first[i] = -1;
+
+	cmd = mp->glcommands;
+	while((gv = get_glcommand(&cmd, &fan, &num)) != NULL) {
+		unsigned short a, b, c;
+
+		if(num < 3)
+			continue;
+
+		/* keep the winding GL would give the strip or fan */
+		a = get_render_vertex(mp, first, next, &(gv[0]));
+		b = get_render_vertex(mp, first, next, &(gv[1]));
+		for(j = 2; j < num; j++) {
+			c = get_render_vertex(mp, first, next, &(gv[j]));
+			if(fan || (j & 1) == 0) {
+				mp->indices[mp->num_indices++] = a;
+				mp->indices[mp->num_indices++] = b;
+			} else {
+				mp->indices[mp->num_indices++] = b;
+				mp->indices[mp->num_indices++] = a;
+			}
+			mp->indices[mp->num_indices++] = c;
+
+			if(fan)
+				b = c;
+			else {
+				a = b;
+				b = c;
+			}
+		}
+	}
+	free(first);
+	free(next);
+
+	if(!optimize_vertex_cache(mp->indices, mp->num_indices / 3, mp->num_render_verts)) {
+		free(remap);
+		return FALSE;
+	}
+
+	/* renumber the vertices so they're fetched in order */
+	verts = malloc(sizeof(unsigned short) * mp->num_render_verts);
+	texcoords = malloc(sizeof(float) * 2 * mp->num_render_verts);
+	if(!verts || !texcoords) {
+		fprintf(stderr, "Error: Couldn't allocate memory for render mesh\n");
+		free(remap);
+		free(verts);
+		free(texcoords);
+		return FALSE;
+	}
+	for(i = 0; i < mp->num_render_verts; i++)
+		remap[i] = 0xffff;
+	j = 0;
+	for(i = 0; i < mp->num_indices; i++) {
+		unsigned short v = mp->indices[i];
+
+		if(remap[v] == 0xffff) {
+			remap[v] = j;
+			verts[j] = mp->render_verts[v];
+			texcoords[j][0] = mp->texcoords[v][0];
+			texcoords[j][1] = mp->texcoords[v][1];
+			j++;
+		}
+		mp->indices[i] = remap[v];
+	}
+	mp->num_render_verts = j;
+
+	free(mp->render_verts);
+	free(mp->texcoords);
+	mp->render_verts = verts;
+	mp->texcoords = texcoords;
+
+	free(remap);
+	return TRUE;
+}
+
+/* checks that the glcommands end in a 0 and only use existing vertices */
+int
+md2_check_glcommands(const int32_t *cmd, unsigned int num_words,
+                     unsigned int num_vertices)
+{
+	const struct md2_glcommand_vertex *gv;
+	unsigned int i, j, num;
+
+	i = 0;
+	while(i < num_words) {
+		if(cmd[i] == 0)
+			return TRUE;
+		if(cmd[i] < -(int32_t)num_words || cmd[i] > (int32_t)num_words)
+			break;
+		num = (cmd[i] < 0) ? -cmd[i] : cmd[i];
+		if(num > (num_words - i - 1) / 3)
+			break;
+
+		gv = (const struct md2_glcommand_vertex *)(cmd + i + 1);
+		for(j = 0; j < num; j++) {
+			if(gv[j].vertexIndex < 0 || gv[j].vertexIndex >= num_vertices) {
+				fprintf(stderr, "Error: glcommand vertex %d out of range\n", gv[j].vertexIndex);
+				return FALSE;
+			}
+		}
+		i += 1 + num * 3;
+	}
+
+	fprintf(stderr, "Error: Bad glcommands\n");
+	return FALSE;
+}
+
+/* checks that a section of count elements of size bytes is inside the file */
+static int
+check_section(int32_t offset, int32_t count, size_t size, int32_t end)
+{
+	if(offset < (int32_t)sizeof(struct md2_header) || offset > end ||
+	   (offset & 3) != 0 || count < 0)
+		return FALSE;
+
+	return ((size_t)count <= (size_t)(end - offset) / size);
+}
+
+static int
+is_degenerate(const struct md2_triangle *t)
+{
+	return (t->vertexIndices[0] == t->vertexIndices[1] ||
+	        t->vertexIndices[1] == t->vertexIndices[2] ||
+	        t->vertexIndices[2] == t->vertexIndices[0]);
+}
+
+/*
+ * checks that the triangles only use existing vertices and texture
+ * coordinates, and none are degenerate; a model without texture coordinates
+ * is still fine, the texture indices are never looked up
+ */
+int
+md2_check_triangles(const struct md2_triangle *t, unsigned int num,
+                    unsigned int num_vertices, unsigned int num_texcoords)
+{
+	unsigned int i, j;
+
+	for(i = 0; i < num; i++) {
+		for(j = 0; j < 3; j++) {
+			if(t[i].vertexIndices[j] < 0 || t[i].vertexIndices[j] >= (int)num_vertices) {
+				fprintf(stderr, "Error: Triangle vertex %d out of range\n", t[i].vertexIndices[j]);
+				return FALSE;
+			}
+			if(num_texcoords &&
+			   (t[i].textureIndices[j] < 0 || t[i].textureIndices[j] >= (int)num_texcoords)) {
+				fprintf(stderr, "Error: Triangle texture coordinate %d out of range\n", t[i].textureIndices[j]);
+				return FALSE;
+			}
+		}
+		if(is_degenerate(&(t[i]))) {
+			fprintf(stderr, "Error: Degenerate triangle\n");
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* frees a model whose pieces are still separately allocated */
+static void
+free_unpacked(struct md2_model *mp)
+{
+	unsigned int i;
+
+	/* what was read from the cache is unmapped with it */
+	if(!mp->cache) {
+		if(mp->render_verts)
+			free(mp->render_verts);
+		if(mp->texcoords)
+			free(mp->texcoords);
+		if(mp->indices)
+			free(mp->indices);
+
+		if(mp->f) {
+			for(i = 0; i < mp->num_frames; i++) {
+				if(mp->f[i].edges)
+					free(mp->f[i].edges);
+			}
+		}
+		if(mp->own_triangles)
+			free(mp->t);
+		if(mp->edge_verts)
+			free(mp->edge_verts);
+		if(mp->edge_tris)
+			free(mp->edge_tris);
+		if(mp->tri_edges)
+			free(mp->tri_edges);
+		if(mp->own_glcommands)
+			free(mp->glcommands);
+	}
+
+	if(mp->f)
+		free(mp->f);
+	if(mp->shadow_buffers)
+		free(mp->shadow_buffers);
+	free(mp);
+}
+
+/* gets rid of a model that failed to load */
+static void
+discard_model(struct md2_model *mp)
+{
+	unmap_file(mp->map, mp->map_size);
+	unmap_file(mp->cache, mp->cache_size);
+	free_unpacked(mp);
+}
+
+/* hands out cache aligned pieces of an arena; with no base it only sizes them */
+struct arena {
+	char *base;
+	size_t used;
+};
+
+static void *
+arena_copy(struct arena *a, const void *src, size_t size)
+{
+	void *p = NULL;
+
+	if(a->base) {
+		p = a->base + a->used;
+		if(size)
+			memcpy(p, src, size);
+	}
+	a->used += (size + 63) & ~(size_t)63;
+
+	return p;
+}
+
+/*
+ * lays out the model and everything allocated for it in the arena; called
+ * once without a base to find the size, then again to copy
+ */
+static struct md2_model *
+layout_model(struct arena *a, const struct md2_model *src)
+{
+	struct md2_model *mp;
+	struct md2_frame *f;
+	void *p;
+	unsigned int i;
+
+	mp = arena_copy(a, src, sizeof(struct md2_model));
+	f = arena_copy(a, src->f, sizeof(struct md2_frame) * src->num_frames);
+	if(mp)
+		mp->f = f;
+	p = arena_copy(a, src->shadow_buffers, sizeof(unsigned int) * src->num_frames);
+	if(mp)
+		mp->shadow_buffers = p;
+
+	/* the rest stays where it is in the cache */
+	if(src->cache)
+		return mp;
+
+	p = arena_copy(a, src->tri_edges, sizeof(unsigned short) * 3 * src->num_triangles);
+	if(mp)
+		mp->tri_edges = p;
+	p = arena_copy(a, src->edge_verts, sizeof(unsigned short) * 2 * src->num_edges);
+	if(mp)
+		mp->edge_verts = p;
+	p = arena_copy(a, src->edge_tris, sizeof(unsigned short) * 2 * src->num_edges);
+	if(mp)
+		mp->edge_tris = p;
+	if(src->own_triangles) {
+		p = arena_copy(a, src->t, sizeof(struct md2_triangle) * src->num_triangles);
+		if(mp)
+			mp->t = p;
+	}
+	if(src->own_glcommands) {
+		p = arena_copy(a, src->glcommands, sizeof(int32_t) * src->num_glcommands);
+		if(mp)
+			mp->glcommands = p;
+	}
+	if(src->num_indices) {
+		p = arena_copy(a, src->render_verts, sizeof(unsigned short) * src->num_render_verts);
+		if(mp)
+			mp->render_verts = p;
+		p = arena_copy(a, src->texcoords, sizeof(float) * 2 * src->num_render_verts);
+		if(mp)
+			mp->texcoords = p;
+		p = arena_copy(a, src->indices, sizeof(unsigned short) * src->num_indices);
+		if(mp)
+			mp->indices = p;
+	}
+
+	for(i = 0; i < src->num_frames; i++) {
+		p = arena_copy(a, src->f[i].edges, sizeof(unsigned short) * src->f[i].num_edges);
+		if(f)
+			f[i].edges = p;
+	}
+
+	return mp;
+}
+
+/* moves a freshly loaded model into a single arena, so it's freed with one free */
+static struct md2_model *
+pack_model(struct md2_model *src)
+{
+	struct md2_model *mp;
+	struct arena a;
+
+	a.base = NULL;
+	a.used = 0;
+	layout_model(&a, src);
+
+	a.base = aligned_malloc(a.used);
+	if(!a.base) {
+		fprintf(stderr, "Error: Couldn't allocate memory for md2 model\n");
+		discard_model(src);
+		return NULL;
+	}
+	a.used = 0;
+	mp = layout_model(&a, src);
+
+	/* the mapping now belongs to the packed model */
+	free_unpacked(src);
+	return mp;
+}
+
+/*
+ * the file is mapped rather than read; the frame vertices are always used
+ * where they are, and on little-endian hosts the triangles and glcommands
+ * are too, so only what's derived from them is allocated
+ */
+struct md2_model *
+md2_load(const char *filename)
+{
+	unsigned int i, j;
+	struct md2_header m;
+	struct md2_model *mp;
+	struct md2_triangle *tris;
+	uint8_t *data;
+	int32_t *p;
+	uint64_t hash;
+	char cache_filename[256];
+	int cache;
+
+	mp = malloc(sizeof(struct md2_model));
+	if(!mp) {
+		fprintf(stderr, "Error: Couldn't allocate memory for md2 model\n");
+		return NULL;
+	}
+	my_bzero(mp, sizeof(struct md2_model));
+	snprintf(mp->name, 128, "%s", filename);
+
+	mp->map = map_file(filename, &(mp->map_size));
+	if(!mp->map) {
+		free(mp);
+		return NULL;
+	}
+	data = mp->map;
+
+	if(mp->map_size < sizeof(struct md2_header)) {
+		fprintf(stderr, "Error: %s is too small to be an md2 model\n", filename);
+		discard_model(mp);
+		return NULL;
+	}
+	memcpy(&m, data, sizeof(struct md2_header));
+	p = (int32_t *)&m.magic;
+	for(i = 0; i < sizeof(struct md2_header) / sizeof(int32_t); i++)
+		p[i] = le_to_native_int(p[i]);
+
+	if(m.magic != MD2_MAGIC || m.version != 8 ||
+	   m.offsetEnd < (int32_t)sizeof(struct md2_header) ||
+	   (size_t)m.offsetEnd > mp->map_size ||
+	   m.numFrames <= 0 || m.numVertices <= 0 || m.numVertices >= 0xffff ||
+	   m.numTexCoords < 0 ||
+	   m.frameSize != (int32_t)(40 + sizeof(struct md2_triangle_vertex) * m.numVertices) ||
+	   !check_section(m.offsetFrames, m.numFrames, m.frameSize, m.offsetEnd) ||
+	   !check_section(m.offsetTriangles, m.numTriangles, sizeof(struct md2_triangle), m.offsetEnd) ||
+	   !check_section(m.offsetGlCommands, m.numGlCommands, sizeof(int32_t), m.offsetEnd)) {
+		fprintf(stderr, "Error: %s isn't a valid md2 model\n", filename);
+		discard_model(mp);
+		return NULL;
+	}
+
+	/* frames */
+	mp->f = malloc(sizeof(struct md2_frame) * m.numFrames);
 	if(!mp->f) {
 		fprintf(stderr, "Error: Couldn't allocate memory for frames\n");
+		discard_model(mp);
 		return NULL;
 	}
-	fseek(fp, m.offsetFrames, SEEK_SET);
+	my_bzero(mp->f, sizeof(struct md2_frame) * m.numFrames);
+	mp->num_frames = m.numFrames;
+	mp->num_vertices = m.numVertices;
 	for(i = 0; i < m.numFrames; i++) {
-		mp->f[i].vertices = malloc(sizeof(struct md2_triangle_vertex) * m.numVertices);
-		fread(&(mp->f[i]), sizeof(struct md2_frame) - sizeof(void *), 1, fp);
-		mp->f[i].scale[0] = le_to_native_float(mp->f[i].scale[0]);
-		mp->f[i].scale[1] = le_to_native_float(mp->f[i].scale[1]);
-		mp->f[i].scale[2] = le_to_native_float(mp->f[i].scale[2]);
-		mp->f[i].translate[0] = le_to_native_float(mp->f[i].translate[0]);
-		mp->f[i].translate[1] = le_to_native_float(mp->f[i].translate[1]);
-		mp->f[i].translate[2] = le_to_native_float(mp->f[i].translate[2]);
-		fread(mp->f[i].vertices, sizeof(struct md2_triangle_vertex), m.numVertices, fp);
-	}
-
-	/* load triangles */
-	mp->t = malloc(sizeof(struct md2_triangle) * m.numTriangles);
-	if(!mp->t) {
-		fprintf(stderr, "Error: Couldn't allocate memory for triangles\n");
-		return NULL;
+		uint8_t *frame = data + m.offsetFrames + i * m.frameSize;
+
+		memcpy(&(mp->f[i]), frame, offsetof(struct md2_frame, vertices));
+		for(j = 0; j < 3; j++) {
+			mp->f[i].scale[j] = le_to_native_float(mp->f[i].scale[j]);
+			mp->f[i].translate[j] = le_to_native_float(mp->f[i].translate[j]);
+		}
+		mp->f[i].vertices = (struct md2_triangle_vertex *)(frame + 40);
+		mp->f[i].num_vertices = m.numVertices;
 	}
-	fseek(fp, m.offsetTriangles, SEEK_SET);
-	fread(mp->t, sizeof(struct md2_triangle), m.numTriangles, fp);
-	for(i = 0; i < m.numTriangles; i++) {
-		mp->t[i].vertexIndices[0] = le_to_native_short(mp->t[i].vertexIndices[0]);
-		mp->t[i].vertexIndices[1] = le_to_native_short(mp->t[i].vertexIndices[1]);
-		mp->t[i].vertexIndices[2] = le_to_native_short(mp->t[i].vertexIndices[2]);
 
-		mp->t[i].textureIndices[0] = le_to_native_short(mp->t[i].textureIndices[0]);
-		mp->t[i].textureIndices[1] = le_to_native_short(mp->t[i].textureIndices[1]);
-		mp->t[i].textureIndices[2] = le_to_native_short(mp->t[i].textureIndices[2]);
+	mp->shadow_buffers = malloc(sizeof(unsigned int) * m.numFrames);
+	if(!mp->shadow_buffers) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow buffers\n");
+		discard_model(mp);
+		return NULL;
 	}
+	my_bzero(mp->shadow_buffers, sizeof(unsigned int) * m.numFrames);
+
+	/* everything else comes from the cache, if it's there and up to date */
+	tris = (struct md2_triangle *)(data + m.offsetTriangles);
+	mp->t = tris;
 	mp->num_triangles = m.numTriangles;
+	if(m.numGlCommands > 0) {
+		mp->glcommands = (int32_t *)(data + m.offsetGlCommands);
+		mp->num_glcommands = m.numGlCommands;
+	}
+	hash = md2_cache_hash(data, mp->map_size);
+	/* a cut off name could be the model's own, so that isn't cached at all */
+	cache = (snprintf(cache_filename, sizeof(cache_filename), "%sc", filename) < (int)sizeof(cache_filename));
+	if(cache && md2_cache_load(mp, cache_filename, hash, m.numTexCoords))
+		return pack_model(mp);
 
-	mp->t_edges = malloc(sizeof(struct md2_tri_edge) * m.numTriangles * 3);
-	if(!mp->t_edges) {
-		fprintf(stderr, "Error: Couldn't allocate memory for triangle edges\n");
+	/* triangles; degenerate ones are dropped, they'd only confuse the edges */
+	for(i = 0; i < m.numTriangles; i++) {
+		if(is_degenerate(&(tris[i])))
+			break;
+	}
+	if(!is_little_endian() || i < m.numTriangles) {
+		mp->t = malloc(sizeof(struct md2_triangle) * (m.numTriangles + 1));
+		if(!mp->t) {
+			fprintf(stderr, "Error: Couldn't allocate memory for triangles\n");
+			discard_model(mp);
+			return NULL;
+		}
+		mp->own_triangles = TRUE;
+		for(i = 0, j = 0; i < m.numTriangles; i++) {
+			mp->t[j].vertexIndices[0] = le_to_native_short(tris[i].vertexIndices[0]);
+			mp->t[j].vertexIndices[1] = le_to_native_short(tris[i].vertexIndices[1]);
+			mp->t[j].vertexIndices[2] = le_to_native_short(tris[i].vertexIndices[2]);
+
+			mp->t[j].textureIndices[0] = le_to_native_short(tris[i].textureIndices[0]);
+			mp->t[j].textureIndices[1] = le_to_native_short(tris[i].textureIndices[1]);
+			mp->t[j].textureIndices[2] = le_to_native_short(tris[i].textureIndices[2]);
+
+			if(!is_degenerate(&(mp->t[j])))
+				j++;
+		}
+		mp->num_triangles = j;
+	}
+	if(!md2_check_triangles(mp->t, mp->num_triangles, m.numVertices, m.numTexCoords)) {
+		discard_model(mp);
 		return NULL;
 	}
-	mp->num_edges = m.numTriangles * 3;
-	my_bzero(mp->t_edges, sizeof(struct md2_tri_edge) * mp->num_edges);
 
-	mp->t_info = malloc(sizeof(struct md2_tri_info) * m.numTriangles);
-	if(!mp->t_info) {
-		fprintf(stderr, "Error: Couldn't allocate memory for triangle info\n");
+	if(!setup_edges(mp)) {
+		discard_model(mp);
 		return NULL;
 	}
-	my_bzero(mp->t_info, sizeof(struct md2_tri_info) * m.numTriangles);
 
-	/* set up edges */
-	for(i = 0; i < m.numTriangles; i++) {
-		struct md2_tri_edge *edge;
+	/* frames are independent, so they're set up across the thread pool */
+	threads_parallel_for(setup_frame, mp, mp->num_frames);
+	for(i = 0; i < mp->num_frames; i++) {
+		if(!mp->f[i].edges) {
+			fprintf(stderr, "Error: Couldn't allocate memory for frames\n");
+			discard_model(mp);
+			return NULL;
+		}
+	}
 
-		edge = get_edge_with_verts(mp->t_edges, mp->num_edges, mp->t[i].vertexIndices[0], mp->t[i].vertexIndices[1]);
-		if(edge->new_tri)
-			edge->triangleIndices[0] = i;
-		else
-			edge->triangleIndices[1] = i;
+	/* glcommands; numGlCommands is the number of 32-bit words */
+	if(m.numGlCommands > 0) {
+		if(!is_little_endian()) {
+			p = malloc(sizeof(int32_t) * m.numGlCommands);
+			if(!p) {
+				fprintf(stderr, "Error: Couldn't allocate memory for glcommands\n");
+				discard_model(mp);
+				return NULL;
+			}
+			for(i = 0; i < m.numGlCommands; i++)
+				p[i] = le_to_native_int(mp->glcommands[i]);
+			mp->glcommands = p;
+			mp->own_glcommands = TRUE;
+		}
+		if(!md2_check_glcommands(mp->glcommands, mp->num_glcommands, m.numVertices)) {
+			discard_model(mp);
+			return NULL;
+		}
+	}
 
-		edge = get_edge_with_verts(mp->t_edges, mp->num_edges, mp->t[i].vertexIndices[1], mp->t[i].vertexIndices[2]);
-		if(edge->new_tri)
-			edge->triangleIndices[0] = i;
-		else
-			edge->triangleIndices[1] = i;
+	if(!setup_render_mesh(mp, m.numVertices)) {
+		discard_model(mp);
+		return NULL;
+	}
 
-		edge = get_edge_with_verts(mp->t_edges, mp->num_edges, mp->t[i].vertexIndices[2], mp->t[i].vertexIndices[0]);
-		if(edge->new_tri)
-			edge->triangleIndices[0] = i;
-		else
-			edge->triangleIndices[1] = i;
+	mp = pack_model(mp);
+	if(mp && cache)
+		md2_cache_write(mp, cache_filename, hash);
+	return mp;
+}
+
+/*
+ * add a simpler mesh of about num_triangles triangles for the model to
+ * cast shadows with from distance on. it's simplified once for all the
+ * keyframes, and stays closed if the model is
+ */
+int
+md2_add_shadow_lod(struct md2_model *mp, unsigned int num_triangles, float distance)
+{
+	struct md2_model *lod;
+	unsigned int i;
+
+	if(mp->num_shadow_lods == MD2_MAX_SHADOW_LODS) {
+		fprintf(stderr, "Error: %s already has %d shadow LODs\n", mp->name, MD2_MAX_SHADOW_LODS);
+		return FALSE;
 	}
 
-	/* load glcommands */
-	mp->g = malloc(sizeof(struct md2_glcommand) * m.numGlCommands);
-	fseek(fp, m.offsetGlCommands, SEEK_SET);
-	for(i = 0; i < m.numGlCommands; i++) {
-		int32_t num;
+	lod = malloc(sizeof(struct md2_model));
+	if(!lod) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow LOD\n");
+		return FALSE;
+	}
+	my_bzero(lod, sizeof(struct md2_model));
+	snprintf(lod->name, 128, "%s", mp->name);
+	lod->num_frames = mp->num_frames;
+	lod->num_vertices = mp->num_vertices;
+	lod->parent = mp;
+
+	/* the frames' vertices are the model's, so only their edges are the LOD's */
+	lod->f = malloc(sizeof(struct md2_frame) * mp->num_frames);
+	lod->shadow_buffers = malloc(sizeof(unsigned int) * mp->num_frames);
+	if(!lod->f || !lod->shadow_buffers) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow LOD\n");
+		free_unpacked(lod);
+		return FALSE;
+	}
+	my_bzero(lod->f, sizeof(struct md2_frame) * mp->num_frames);
+	my_bzero(lod->shadow_buffers, sizeof(unsigned int) * mp->num_frames);
 
-		fread(&num, 4, 1, fp);
-		num = le_to_native_int(num);
-		if(num < 0) {
-			mp->g[i].type = 1;
-			num = -num;
-		} else {
-			mp->g[i].type = 0;
-		}
-		mp->g[i].num_vertices = num;
-		mp->g[i].vertices = malloc(sizeof(struct md2_glcommand_vertex) * num);
-		fread(mp->g[i].vertices, sizeof(struct md2_glcommand_vertex), num, fp);
-		for(j = 0; j < mp->g[i].num_vertices; j++) {
-			mp->g[i].vertices[j].s = le_to_native_float(mp->g[i].vertices[j].s);
-			mp->g[i].vertices[j].t = le_to_native_float(mp->g[i].vertices[j].t);
-			mp->g[i].vertices[j].vertexIndex = le_to_native_uint(mp->g[i].vertices[j].vertexIndex);
+	lod->t = md2_simplify(mp, num_triangles, &(lod->num_triangles));
+	if(!lod->t) {
+		free_unpacked(lod);
+		return FALSE;
+	}
+	lod->own_triangles = TRUE;
+
+	if(!setup_edges(lod)) {
+		free_unpacked(lod);
+		return FALSE;
+	}
+	threads_parallel_for(setup_frame, lod, lod->num_frames);
+	for(i = 0; i < lod->num_frames; i++) {
+		if(!lod->f[i].edges) {
+			fprintf(stderr, "Error: Couldn't allocate memory for frames\n");
+			free_unpacked(lod);
+			return FALSE;
 		}
 	}
 
-	mp->num_frames = m.numFrames;
-	mp->num_glcommands = m.numGlCommands;
+	lod = pack_model(lod);
+	if(!lod)
+		return FALSE;
+
+	/* keep them in order of distance */
+	for(i = mp->num_shadow_lods; i > 0 && mp->shadow_lod_distances[i - 1] > distance; i--) {
+		mp->shadow_lods[i] = mp->shadow_lods[i - 1];
+		mp->shadow_lod_distances[i] = mp->shadow_lod_distances[i - 1];
+	}
+	mp->shadow_lods[i] = lod;
+	mp->shadow_lod_distances[i] = distance;
+	mp->num_shadow_lods++;
+
+	return TRUE;
+}
+
+/* get the mesh to cast shadows with at the given distance; the model itself when it's close */
+struct md2_model *
+md2_get_shadow_lod(struct md2_model *mp, float distance)
+{
+	unsigned int i;
+
+	for(i = mp->num_shadow_lods; i > 0; i--) {
+		if(distance >= mp->shadow_lod_distances[i - 1])
+			return mp->shadow_lods[i - 1];
+	}
 
-	fclose(fp);
 	return mp;
 }
 
 void
 md2_free(struct md2_model *mp)
 {
+	unsigned int i;
+
 	if(!mp)
 		return;
 
-	if(mp->f)
-		free(mp->f);
-	if(mp->t)
-		free(mp->t);
-	if(mp->t_info)
-		free(mp->t_info);
-	if(mp->t_edges)
-		free(mp->t_edges);
-	if(mp->g)
-		free(mp->g);
+	for(i = 0; i < mp->num_shadow_lods; i++)
+		md2_free(mp->shadow_lods[i]);
+
+	evict_model_frames(mp);
+
+	for(i = 0; i < mp->num_frames; i++) {
+		if(mp->shadow_buffers[i])
+			glDeleteBuffers(1, &(mp->shadow_buffers[i]));
+	}
+	if(mp->render_buffers[0]) {
+		glDeleteBuffers(3, mp->render_buffers);
+		glDeleteBuffers(1, &(mp->stream_buffer));
+		glDeleteBuffers(1, &(mp->color_buffer));
+	}
+
+	unmap_file(mp->map, mp->map_size);
+	unmap_file(mp->cache, mp->cache_size);
 	free(mp);
 }
+
+/*
+ * create a player for the model, showing the first frame of ANIM_STAND
+ * until another animation is chosen
+ */
+struct md2_player *
+md2_player_create(struct md2_model *mp)
+{
+	struct md2_player *pp;
+
+	pp = malloc(sizeof(struct md2_player));
+	if(!pp) {
+		fprintf(stderr, "Error: Couldn't allocate memory for animation player\n");
+		return NULL;
+	}
+	my_bzero(pp, sizeof(struct md2_player));
+
+	pp->blend = aligned_malloc(sizeof(float) * 3 * mp->num_vertices);
+	pp->colors = aligned_malloc(sizeof(unsigned char) * 4 * mp->num_vertices);
+	if(!pp->blend || !pp->colors) {
+		fprintf(stderr, "Error: Couldn't allocate memory for animation player\n");
+		free(pp->blend);
+		free(pp->colors);
+		free(pp);
+		return NULL;
+	}
+
+	pp->mp = mp;
+	pp->fps = MD2_ANIM_FPS;
+	pp->pose.shadow_lerp = -1.0f;
+	md2_player_set_animation(pp, ANIM_STAND);
+	if(!pp->pinned) {
+		free(pp->blend);
+		free(pp->colors);
+		free(pp);
+		return NULL;
+	}
+
+	return pp;
+}
+
+void
+md2_player_free(struct md2_player *pp)
+{
+	if(!pp)
+		return;
+
+	if(pp->pinned) {
+		md2_release_frame(pp->mp, pp->pinned_frame);
+		md2_release_frame(pp->mp, pp->pinned_next_frame);
+	}
+	if(pp->pose.shadow_buffer)
+		glDeleteBuffers(1, &(pp->pose.shadow_buffer));
+	if(pp->blend)
+		free(pp->blend);
+	if(pp->colors)
+		free(pp->colors);
+	free(pp);
+}
+
+/* restart the player at the beginning of the given animation */
+void
+md2_player_set_animation(struct md2_player *pp, unsigned int anim)
+{
+	md2_get_animation_frames(anim, &(pp->start_frame), &(pp->end_frame));
+
+	/* models don't have to have every animation */
+	if(pp->end_frame >= pp->mp->num_frames)
+		pp->end_frame = pp->mp->num_frames - 1;
+	if(pp->start_frame > pp->end_frame)
+		pp->start_frame = pp->end_frame;
+
+	pp->time = 0.0f;
+	md2_player_update(pp, 0.0f);
+}
+
+/*
+ * advance the animation by the given number of seconds and blend the two
+ * keyframes on either side of the new time; the last frame of a looping
+ * animation blends back into the first. a pose that falls exactly on a
+ * keyframe uses the keyframe's vertices as they are. the keyframes are
+ * pinned in the frame cache while the pose uses them, and the one after
+ * is decoded in the background
+ */
+void
+md2_player_update(struct md2_player *pp, float seconds)
+{
+	struct md2_model *mp = pp->mp;
+	struct md2_pose *pose = &(pp->pose);
+	unsigned int num_frames, n, frame, next_frame;
+	float lerp;
+
+	num_frames = pp->end_frame - pp->start_frame + 1;
+	pp->time += seconds * pp->fps;
+	if(pp->time >= (float)num_frames || pp->time < 0.0f)
+		pp->time = fmodf(pp->time, (float)num_frames);
+	if(pp->time < 0.0f)
+		pp->time += (float)num_frames;
+
+	n = (unsigned int)pp->time;
+	if(n >= num_frames)
+		n = num_frames - 1;
+	frame = pp->start_frame + n;
+	next_frame = pp->start_frame + (n + 1) % num_frames;
+	lerp = pp->time - (float)n;
+	if(lerp == 0.0f || frame == next_frame) {
+		next_frame = frame;
+		lerp = 0.0f;
+	}
+
+	if(!pp->pinned || frame != pp->pinned_frame || next_frame != pp->pinned_next_frame) {
+		/* the old pose stays as it is if the new one can't be had */
+		if(!md2_get_frame(mp, frame))
+			return;
+		if(!md2_get_frame(mp, next_frame)) {
+			md2_release_frame(mp, frame);
+			return;
+		}
+		if(pp->pinned) {
+			md2_release_frame(mp, pp->pinned_frame);
+			md2_release_frame(mp, pp->pinned_next_frame);
+		}
+		pp->pinned = TRUE;
+		pp->pinned_frame = frame;
+		pp->pinned_next_frame = next_frame;
+
+		md2_prefetch_frame(mp, pp->start_frame + (next_frame - pp->start_frame + 1) % num_frames);
+	}
+
+	pose->frame = frame;
+	pose->next_frame = next_frame;
+	pose->lerp = lerp;
+	if(lerp == 0.0f) {
+		pose->verts = mp->f[frame].positions;
+	} else {
+		lerp_vectors(pp->blend[0], mp->f[frame].positions[0],
+		             mp->f[next_frame].positions[0], lerp,
+		             mp->num_vertices * 3);
+		pose->verts = pp->blend;
+	}
+}
+
+/*
+ * light the pose's vertices with every light, blended the same way as the
+ * lightmaps; how much each of the normals faces a light is worked out once
+ * per light, from the middle of the model, so lighting a vertex is a table
+ * lookup and its attenuation. normals come from whichever keyframe the
+ * pose is closer to
+ */
+void
+md2_player_light(struct md2_player *pp, float model_pos[3],
+                 float model_rot[3], float ambient)
+{
+	struct md2_model *mp = pp->mp;
+	struct md2_pose *pose = &(pp->pose);
+	struct md2_frame *f;
+	float shade[MAX_LIGHTS][256];
+	float pos[MAX_LIGHTS][3], color[MAX_LIGHTS][3];
+	int nums[MAX_LIGHTS];
+	float center[3], model_center[3], dir[3], d[3], dark[3];
+	float radius, len, c;
+	unsigned int i, j, num_lights;
+	int n;
+
+	pose->colors = NULL;
+	if(!pose->verts)
+		return;
+
+	md2_get_bounding_sphere(mp, pose, model_pos, model_rot, center, &radius);
+	model_center[0] = center[0];
+	model_center[1] = center[1];
+	model_center[2] = center[2];
+	untransform_vertex(model_center, model_pos, model_rot);
+
+	num_lights = 0;
+	for(n = 0; n < MAX_LIGHTS; n++) {
+		/* lights that can't reach the model are skipped */
+		len = get_light_radius(n);
+		if(len == 0.0f)
+			continue;
+		get_light_position(n, pos[num_lights]);
+		d[0] = pos[num_lights][0] - center[0];
+		d[1] = pos[num_lights][1] - center[1];
+		d[2] = pos[num_lights][2] - center[2];
+		if(VEC_MAGNITUDE(d) > len + radius)
+			continue;
+
+		untransform_vertex(pos[num_lights], model_pos, model_rot);
+		get_light_color(n, color[num_lights]);
+
+		dir[0] = pos[num_lights][0] - model_center[0];
+		dir[1] = pos[num_lights][1] - model_center[1];
+		dir[2] = pos[num_lights][2] - model_center[2];
+		len = VEC_MAGNITUDE(dir);
+		if(len > 0.0f) {
+			dir[0] /= len;
+			dir[1] /= len;
+			dir[2] /= len;
+		}
+
+		/* vertices with a normal index past the table aren't lit directly */
+		for(i = 0; i < 256; i++) {
+			shade[num_lights][i] = 0.0f;
+			if(i < NUM_ANORMS && len > 0.0f) {
+				c = anorms[i][0] * dir[0] + anorms[i][1] * dir[1] + anorms[i][2] * dir[2];
+				if(c > 0.0f)
+					shade[num_lights][i] = c;
+			}
+		}
+		nums[num_lights++] = n;
+	}
+
+	f = mp->f + ((pose->lerp < 0.5f) ? pose->frame : pose->next_frame);
+	for(i = 0; i < mp->num_vertices; i++) {
+		/* each light lights up a share of what the others left dark */
+		dark[0] = dark[1] = dark[2] = 1.0f - ambient;
+		for(j = 0; j < num_lights; j++) {
+			d[0] = pos[j][0] - pose->verts[i][0];
+			d[1] = pos[j][1] - pose->verts[i][1];
+			d[2] = pos[j][2] - pose->verts[i][2];
+			c = light_attenuation(nums[j], d) * shade[j][(f->vertices[i].lightNormalIndex)];
+			dark[0] *= 1.0f - c * color[j][0];
+			dark[1] *= 1.0f - c * color[j][1];
+			dark[2] *= 1.0f - c * color[j][2];
+		}
+		pp->colors[i][0] = (unsigned char)((1.0f - dark[0]) * 255.0f + 0.5f);
+		pp->colors[i][1] = (unsigned char)((1.0f - dark[1]) * 255.0f + 0.5f);
+		pp->colors[i][2] = (unsigned char)((1.0f - dark[2]) * 255.0f + 0.5f);
+		pp->colors[i][3] = 255;
+	}
+	pose->colors = pp->colors;
+}
+
+/* place the model in the scene, with its own animation player */
+int
+md2_instance_init(struct md2_instance *ip, struct md2_model *mp,
+                  float pos[3], float rot[3])
+{
+	my_bzero(ip, sizeof(struct md2_instance));
+
+	ip->player = md2_player_create(mp);
+	if(!ip->player)
+		return FALSE;
+
+	ip->mp = mp;
+	ip->pos[0] = pos[0];
+	ip->pos[1] = pos[1];
+	ip->pos[2] = pos[2];
+	ip->rot[0] = rot[0];
+	ip->rot[1] = rot[1];
+	ip->rot[2] = rot[2];
+	md2_get_bounding_sphere(mp, &(ip->player->pose), ip->pos, ip->rot, ip->center, &(ip->radius));
+
+	return TRUE;
+}
+
+void
+md2_instance_destroy(struct md2_instance *ip)
+{
+	md2_player_free(ip->player);
+	ip->player = NULL;
+}
+
+/* advance the animations of a batch of instances and update their bounds */
+void
+md2_update_instances(struct md2_instance *instances, unsigned int num,
+                     float seconds)
+{
+	struct md2_instance *ip;
+	unsigned int i;
+
+	for(i = 0; i < num; i++) {
+		ip = instances + i;
+		md2_player_update(ip->player, seconds);
+		md2_get_bounding_sphere(ip->mp, &(ip->player->pose), ip->pos, ip->rot, ip->center, &(ip->radius));
+	}
+}
@@ -26,6 +26,7 @@
 #ifndef __MD2_H__
 #define __MD2_H__
 
+#include <stddef.h>
 #include "endian.h"
 
 #define ANIM_STAND	0
@@ -42,6 +43,13 @@
 #define ANIM_WAVE	11
 #define ANIM_ATTACK	12
 
+#define MD2_ANIM_FPS 10.0f
+
+/* default size of the decoded frames kept around for all models */
+#define MD2_FRAME_CACHE_BUDGET (16 * 1024 * 1024)
+
+#define MD2_MAX_SHADOW_LODS 4
+
 struct md2_triangle_vertex {
 	uint8_t vertex[3];
 	uint8_t lightNormalIndex;
@@ -52,24 +60,22 @@ struct md2_triangle {
 	int16_t textureIndices[3];
 };
 
-struct md2_tri_edge {
-	char taken;
-
-	short vertexIndices[2];
-	char new_tri;
-	short triangleIndices[2];
-};
-
-struct md2_tri_info {
-	char visible;
-	char drawn;
-};
-
 struct md2_frame {
 	float scale[3];
 	float translate[3];
 	int8_t name[16];
-	struct md2_triangle_vertex *vertices;
+	struct md2_triangle_vertex *vertices; /* in the mapped file */
+	unsigned int num_vertices;
+
+	/* the decoded vertices in model space, while in the frame cache */
+	float (*positions)[3];
+	int pins;
+	struct md2_frame *lru_prev;
+	struct md2_frame *lru_next;
+
+	/* edges that can be on the silhouette in this frame */
+	unsigned short *edges;
+	unsigned int num_edges;
 };
 
 struct md2_glcommand_vertex {
@@ -77,32 +83,176 @@ struct md2_glcommand_vertex {
 	int32_t vertexIndex;
 };
 
-struct md2_glcommand {
-	int32_t type;
-	int32_t num_vertices;
-	struct md2_glcommand_vertex *vertices;
-};
-
 struct md2_model {
 	char name[128];
 
 	struct md2_frame *f;
 	unsigned int num_frames;
+	unsigned int num_vertices;
 	struct md2_triangle *t;
-	struct md2_tri_info *t_info;
 	unsigned int num_triangles;
-	struct md2_tri_edge *t_edges;
+
+	/* edges, as vertex pairs in the order of the first triangle */
+	unsigned short (*edge_verts)[2];
+	unsigned short (*edge_tris)[2];
 	unsigned int num_edges;
-	struct md2_glcommand *g;
-	unsigned int num_glcommands;
+	unsigned short (*tri_edges)[3];
+
+	/*
+	 * the glcommands, as in the file: a vertex count (negative for a
+	 * fan) followed by that many vertices, until a count of 0
+	 */
+	int32_t *glcommands;
+	unsigned int num_glcommands; /* in 32-bit words */
+
+	/* the glcommands as an indexed triangle list, for md2_render */
+	unsigned short *render_verts; /* frame vertex of each render vertex */
+	float (*texcoords)[2];
+	unsigned int num_render_verts;
+	unsigned short *indices;
+	unsigned int num_indices;
+	unsigned int render_buffers[3]; /* positions of all frames, texcoords, indices */
+	unsigned int stream_buffer; /* positions of blended poses */
+	unsigned int color_buffer; /* colors of lit poses */
+
+	unsigned int *shadow_buffers;
+
+	/*
+	 * the file; triangles and glcommands are used in place if possible,
+	 * and everything else is in one arena along with the model itself,
+	 * unless it's in the cache
+	 */
+	void *map;
+	size_t map_size;
+	int own_triangles; /* copies, rather than in the file */
+	int own_glcommands;
+
+	/* the .md2c the derived data is in, if it was cached */
+	void *cache;
+	size_t cache_size;
+
+	/*
+	 * simpler meshes to cast shadows with, from the finest to the
+	 * coarsest, and the distance each is used from. they share the
+	 * model's vertices, so they're used with the model's poses
+	 */
+	struct md2_model *shadow_lods[MD2_MAX_SHADOW_LODS];
+	float shadow_lod_distances[MD2_MAX_SHADOW_LODS];
+	unsigned int num_shadow_lods;
+
+	/*
+	 * for a shadow LOD, the model its frames' vertices are decoded from;
+	 * the LOD's own frames only have edges
+	 */
+	struct md2_model *parent;
+};
+
+/* the vertices of a model somewhere between two keyframes */
+struct md2_pose {
+	unsigned int frame;
+	unsigned int next_frame;
+	float lerp; /* 0 is frame, 1 would be next_frame */
+	float (*verts)[3];
+	unsigned char (*colors)[4]; /* the lit vertices, or NULL if unlit */
+
+	/* the shadow mesh of the pose, when it's between keyframes */
+	unsigned int shadow_buffer;
+	struct md2_model *shadow_mp;
+	unsigned int shadow_frame;
+	unsigned int shadow_next_frame;
+	float shadow_lerp;
+};
+
+/* plays one of a model's animations, independent of the frame rate */
+struct md2_player {
+	struct md2_model *mp;
+	struct md2_pose pose;
+
+	unsigned int start_frame;
+	unsigned int end_frame;
+	float time; /* in frames since start_frame */
+	float fps;
+
+	float (*blend)[3]; /* the pose's vertices, when between keyframes */
+	unsigned char (*colors)[4];
+
+	/* the keyframes held in the frame cache for the pose */
+	int pinned;
+	unsigned int pinned_frame;
+	unsigned int pinned_next_frame;
+};
+
+/* one placement of a model, which may be shared by many instances */
+struct md2_instance {
+	struct md2_model *mp;
+	struct md2_player *player;
+	float pos[3];
+	float rot[3];
+
+	/* bounding sphere of the current pose, in world coordinates */
+	float center[3];
+	float radius;
+	int visible;
+};
+
+struct md2_tri_dist {
+	float dist;
+	unsigned int tri;
+};
+
+/* the silhouette and shadow volume of a model as seen from one light */
+struct md2_shadow {
+	struct md2_model *mp; /* the model, or shadow LOD, it was last used with */
+	int valid;
+	unsigned int frame;
+	unsigned int next_frame;
+	float lerp;
+	float ref_light[3]; /* model space light position dists are from */
+
+	uint32_t *facing; /* a bit for each triangle, set if it faces the light */
+	struct md2_tri_dist *dists; /* sorted by distance from ref_light */
+	uint32_t *candidates; /* a bit for each edge that's checked for the pose */
+
+	/* edge index << 1, with the low bit set if the edge is reversed */
+	unsigned int *silhouette;
+	unsigned int num_silhouette_edges;
+	int *slots; /* each edge's index in silhouette, or -1 */
+
+	int built;
+	int has_caps;
+	float key[13];
+	float (*verts)[3];
+	unsigned int num_quad_verts;
+	unsigned int num_cap_verts;
 };
 
 /* functions */
 void md2_get_animation_frames(unsigned int anim, unsigned int *start_frame, unsigned int *end_frame);
-void md2_calculate_visible_tris(struct md2_model *mp, unsigned int frame, float model_pos[3], float model_rot[3], float p[3]);
-void md2_render_shadow_volume(struct md2_model *mp, unsigned int frame, float model_pos[3], float model_rot[3], float light_pos[3]);
-void md2_render(struct md2_model *mp, unsigned int frame);
+void md2_calculate_visible_tris(struct md2_model *mp, struct md2_shadow *sp, struct md2_pose *pose, float model_pos[3], float model_rot[3], float p[3]);
+void md2_get_bounding_sphere(struct md2_model *mp, struct md2_pose *pose, float model_pos[3], float model_rot[3], float center[3], float *radius);
+void md2_set_shadow_bounds(float mins[3], float maxs[3]);
+struct md2_shadow *md2_shadow_create(struct md2_model *mp);
+void md2_shadow_free(struct md2_shadow *sp);
+void md2_build_shadow_volume(struct md2_model *mp, struct md2_shadow *sp, struct md2_pose *pose, float model_pos[3], float model_rot[3], float light_pos[3], float light_radius, int caps);
+void md2_render_shadow_volume(struct md2_shadow *sp, int caps);
+int md2_init_shadow_shader();
+void md2_render_shadow_volume_gpu(struct md2_model *mp, struct md2_pose *pose, float model_pos[3], float model_rot[3], float light_pos[3], int caps);
+void md2_render(struct md2_model *mp, struct md2_pose *pose);
+void md2_set_frame_cache_budget(size_t bytes);
+int md2_get_frame(struct md2_model *mp, unsigned int frame);
+void md2_release_frame(struct md2_model *mp, unsigned int frame);
+void md2_prefetch_frame(struct md2_model *mp, unsigned int frame);
 struct md2_model *md2_load(const char *filename);
+int md2_add_shadow_lod(struct md2_model *mp, unsigned int num_triangles, float distance);
+struct md2_model *md2_get_shadow_lod(struct md2_model *mp, float distance);
 void md2_free(struct md2_model *mp);
+struct md2_player *md2_player_create(struct md2_model *mp);
+void md2_player_free(struct md2_player *pp);
+void md2_player_set_animation(struct md2_player *pp, unsigned int anim);
+void md2_player_update(struct md2_player *pp, float seconds);
+void md2_player_light(struct md2_player *pp, float model_pos[3], float model_rot[3], float ambient);
+int md2_instance_init(struct md2_instance *ip, struct md2_model *mp, float pos[3], float rot[3]);
+void md2_instance_destroy(struct md2_instance *ip);
+void md2_update_instances(struct md2_instance *instances, unsigned int num, float seconds);
 
 #endif /* __MD2_H__ */
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * a cache of everything md2_load derives from a model, written next to it
+ * in the layout it's used in, so loading it is just mapping it. it's only
+ * meant to be read on the machine that wrote it, and is thrown away when
+ * the model's contents change
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "my_math.h"
+#include "mapfile.h"
+#include "md2cache.h"
+
+/* bump this whenever anything md2_load derives changes */
+#define MD2C_VERSION	2
+#define MD2C_MAGIC		(('C' << 24) | ('2' << 16) | ('D' << 8) | 'M')
+#define MD2C_BYTE_ORDER	0x01020304
+
+struct md2c_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t source_size;
+	uint64_t hash;
+
+	uint32_t num_frames;
+	uint32_t num_vertices;
+	uint32_t num_triangles;
+	uint32_t num_edges;
+	uint32_t num_glcommands;
+	uint32_t num_render_verts;
+	uint32_t num_indices;
+	uint32_t own_triangles;
+	uint32_t own_glcommands;
+
+	/* offsets of the sections from the start of the file */
+	uint32_t triangles;
+	uint32_t glcommands;
+	uint32_t tri_edges;
+	uint32_t edge_verts;
+	uint32_t edge_tris;
+	uint32_t render_verts;
+	uint32_t texcoords;
+	uint32_t indices;
+	uint32_t frames;
+};
+
+struct md2c_frame {
+	uint32_t edges;
+	uint32_t num_edges;
+};
+
+/* 64-bit FNV-1a */
+uint64_t
+md2_cache_hash(const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/* the offset a section of size bytes goes at; sections are cache aligned */
+static uint32_t
+add_section(uint32_t *size, size_t section_size)
+{
+	uint32_t offset = *size;
+
+	*size += (section_size + 63) & ~(size_t)63;
+	return offset;
+}
+
+static int
+section_fits(uint32_t offset, size_t section_size, size_t file_size)
+{
+	return (offset <= file_size && (offset & 3) == 0 &&
+	        section_size <= file_size - offset);
+}
+
+/* checks that every index is below count */
+static int
+indices_fit(const unsigned short *indices, size_t num, unsigned int count)
+{
+	size_t i;
+
+	for(i = 0; i < num; i++) {
+		if(indices[i] >= count)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * points the model's derived data into the cache file, if there's one for
+ * this exact model; the model must already have its frames, and its
+ * triangles and glcommands as they are in the file
+ */
+int
+md2_cache_load(struct md2_model *mp, const char *filename, uint64_t hash,
+               unsigned int num_texcoords)
+{
+	struct md2c_header *h;
+	struct md2c_frame *cf;
+	struct md2_triangle *t;
+	int32_t *glcommands;
+	struct stat st;
+	uint8_t *data;
+	size_t size;
+	unsigned int i;
+
+	/* not having a cache yet isn't an error */
+	if(stat(filename, &st) == -1)
+		return FALSE;
+
+	data = map_file(filename, &size);
+	if(!data)
+		return FALSE;
+	h = (struct md2c_header *)data;
+
+	if(size < sizeof(struct md2c_header) || h->magic != MD2C_MAGIC ||
+	   h->version != MD2C_VERSION || h->byte_order != MD2C_BYTE_ORDER ||
+	   h->hash != hash || h->source_size != mp->map_size ||
+	   h->num_frames != mp->num_frames || h->num_vertices != mp->num_vertices ||
+	   !section_fits(h->triangles, sizeof(struct md2_triangle) * (h->own_triangles ? h->num_triangles : 0), size) ||
+	   !section_fits(h->glcommands, sizeof(int32_t) * (h->own_glcommands ? h->num_glcommands : 0), size) ||
+	   !section_fits(h->tri_edges, sizeof(unsigned short) * 3 * h->num_triangles, size) ||
+	   !section_fits(h->edge_verts, sizeof(unsigned short) * 2 * h->num_edges, size) ||
+	   !section_fits(h->edge_tris, sizeof(unsigned short) * 2 * h->num_edges, size) ||
+	   !section_fits(h->render_verts, sizeof(unsigned short) * h->num_render_verts, size) ||
+	   !section_fits(h->texcoords, sizeof(float) * 2 * h->num_render_verts, size) ||
+	   !section_fits(h->indices, sizeof(unsigned short) * h->num_indices, size) ||
+	   !section_fits(h->frames, sizeof(struct md2c_frame) * h->num_frames, size)) {
+		unmap_file(data, size);
+		return FALSE;
+	}
+
+	/*
+	 * the cache is trusted no more than the model: everything it indexes
+	 * must exist, or the model is rebuilt from the file. triangles are
+	 * only ever dropped (the degenerate ones), and glcommands are kept
+	 */
+	t = h->own_triangles ? (struct md2_triangle *)(data + h->triangles) : mp->t;
+	glcommands = h->own_glcommands ? (int32_t *)(data + h->glcommands) : mp->glcommands;
+	if((h->own_triangles ? h->num_triangles > mp->num_triangles : h->num_triangles != mp->num_triangles) ||
+	   h->num_glcommands != mp->num_glcommands ||
+	   h->num_edges > 3 * h->num_triangles || h->num_indices % 3 != 0 ||
+	   !md2_check_triangles(t, h->num_triangles, h->num_vertices, num_texcoords) ||
+	   (h->num_glcommands && !md2_check_glcommands(glcommands, h->num_glcommands, h->num_vertices)) ||
+	   !indices_fit((unsigned short *)(data + h->tri_edges), 3 * (size_t)h->num_triangles, h->num_edges) ||
+	   !indices_fit((unsigned short *)(data + h->edge_verts), 2 * (size_t)h->num_edges, h->num_vertices) ||
+	   !indices_fit((unsigned short *)(data + h->edge_tris), 2 * (size_t)h->num_edges, h->num_triangles) ||
+	   !indices_fit((unsigned short *)(data + h->render_verts), h->num_render_verts, h->num_vertices) ||
+	   !indices_fit((unsigned short *)(data + h->indices), h->num_indices, h->num_render_verts)) {
+		unmap_file(data, size);
+		return FALSE;
+	}
+
+	cf = (struct md2c_frame *)(data + h->frames);
+	for(i = 0; i < h->num_frames; i++) {
+		if(cf[i].num_edges > h->num_edges ||
+		   !section_fits(cf[i].edges, sizeof(unsigned short) * cf[i].num_edges, size) ||
+		   !indices_fit((unsigned short *)(data + cf[i].edges), cf[i].num_edges, h->num_edges)) {
+			unmap_file(data, size);
+			return FALSE;
+		}
+	}
+
+	mp->cache = data;
+	mp->cache_size = size;
+
+	if(h->own_triangles) {
+		mp->t = (struct md2_triangle *)(data + h->triangles);
+		mp->own_triangles = TRUE;
+	}
+	mp->num_triangles = h->num_triangles;
+	if(h->own_glcommands) {
+		mp->glcommands = (int32_t *)(data + h->glcommands);
+		mp->own_glcommands = TRUE;
+	}
+	mp->num_glcommands = h->num_glcommands;
+
+	mp->tri_edges = (unsigned short (*)[3])(data + h->tri_edges);
+	mp->edge_verts = (unsigned short (*)[2])(data + h->edge_verts);
+	mp->edge_tris = (unsigned short (*)[2])(data + h->edge_tris);
+	mp->num_edges = h->num_edges;
+
+	if(h->num_indices) {
+		mp->render_verts = (unsigned short *)(data + h->render_verts);
+		mp->texcoords = (float (*)[2])(data + h->texcoords);
+		mp->indices = (unsigned short *)(data + h->indices);
+	}
+	mp->num_render_verts = h->num_render_verts;
+	mp->num_indices = h->num_indices;
+
+	for(i = 0; i < h->num_frames; i++) {
+		mp->f[i].edges = (unsigned short *)(data + cf[i].edges);
+		mp->f[i].num_edges = cf[i].num_edges;
+	}
+
+	return TRUE;
+}
+
+static void
+copy_section(uint8_t *data, uint32_t offset, const void *src, size_t size)
+{
+	if(size)
+		memcpy(data + offset, src, size);
+}
+
+/* writes the model's derived data; it's written to a temporary file first so a reader never sees half of it */
+int
+md2_cache_write(struct md2_model *mp, const char *filename, uint64_t hash)
+{
+	struct md2c_header h;
+	struct md2c_frame *cf;
+	uint8_t *data;
+	uint32_t size;
+	unsigned int i;
+	int ok;
+
+	memset(&h, 0, sizeof(struct md2c_header));
+	h.magic = MD2C_MAGIC;
+	h.version = MD2C_VERSION;
+	h.byte_order = MD2C_BYTE_ORDER;
+	h.source_size = mp->map_size;
+	h.hash = hash;
+	h.num_frames = mp->num_frames;
+	h.num_vertices = mp->num_vertices;
+	h.num_triangles = mp->num_triangles;
+	h.num_edges = mp->num_edges;
+	h.num_glcommands = mp->num_glcommands;
+	h.num_render_verts = mp->num_render_verts;
+	h.num_indices = mp->num_indices;
+	h.own_triangles = mp->own_triangles;
+	h.own_glcommands = mp->own_glcommands;
+
+	size = 0;
+	add_section(&size, sizeof(struct md2c_header));
+	h.triangles = add_section(&size, sizeof(struct md2_triangle) * (mp->own_triangles ? mp->num_triangles : 0));
+	h.glcommands = add_section(&size, sizeof(int32_t) * (mp->own_glcommands ? mp->num_glcommands : 0));
+	h.tri_edges = add_section(&size, sizeof(unsigned short) * 3 * mp->num_triangles);
+	h.edge_verts = add_section(&size, sizeof(unsigned short) * 2 * mp->num_edges);
+	h.edge_tris = add_section(&size, sizeof(unsigned short) * 2 * mp->num_edges);
+	h.render_verts = add_section(&size, sizeof(unsigned short) * mp->num_render_verts);
+	h.texcoords = add_section(&size, sizeof(float) * 2 * mp->num_render_verts);
+	h.indices = add_section(&size, sizeof(unsigned short) * mp->num_indices);
+	h.frames = add_section(&size, sizeof(struct md2c_frame) * mp->num_frames);
+
+	cf = malloc(sizeof(struct md2c_frame) * mp->num_frames);
+	if(!cf) {
+		fprintf(stderr, "Error: Couldn't allocate memory for model cache\n");
+		return FALSE;
+	}
+	for(i = 0; i < mp->num_frames; i++) {
+		cf[i].edges = add_section(&size, sizeof(unsigned short) * mp->f[i].num_edges);
+		cf[i].num_edges = mp->f[i].num_edges;
+	}
+
+	data = calloc(size, 1);
+	if(!data) {
+		fprintf(stderr, "Error: Couldn't allocate memory for model cache\n");
+		free(cf);
+		return FALSE;
+	}
+	memcpy(data, &h, sizeof(struct md2c_header));
+	if(mp->own_triangles)
+		copy_section(data, h.triangles, mp->t, sizeof(struct md2_triangle) * mp->num_triangles);
+	if(mp->own_glcommands)
+		copy_section(data, h.glcommands, mp->glcommands, sizeof(int32_t) * mp->num_glcommands);
+	copy_section(data, h.tri_edges, mp->tri_edges, sizeof(unsigned short) * 3 * mp->num_triangles);
+	copy_section(data, h.edge_verts, mp->edge_verts, sizeof(unsigned short) * 2 * mp->num_edges);
+	copy_section(data, h.edge_tris, mp->edge_tris, sizeof(unsigned short) * 2 * mp->num_edges);
+	if(mp->num_indices) {
+		copy_section(data, h.render_verts, mp->render_verts, sizeof(unsigned short) * mp->num_render_verts);
+		copy_section(data, h.texcoords, mp->texcoords, sizeof(float) * 2 * mp->num_render_verts);
+		copy_section(data, h.indices, mp->indices, sizeof(unsigned short) * mp->num_indices);
+	}
+	copy_section(data, h.frames, cf, sizeof(struct md2c_frame) * mp->num_frames);
+	for(i = 0; i < mp->num_frames; i++) {
+		copy_section(data, cf[i].edges, mp->f[i].edges, sizeof(unsigned short) * mp->f[i].num_edges);
+	}
+	free(cf);
+
+	ok = replace_file(filename, NULL, 0, data, size);
+	free(data);
+
+	return ok;
+}
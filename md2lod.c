@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * builds simpler versions of a model's mesh for casting shadows, by
+ * collapsing edges in the order of the error each adds (Garland and
+ * Heckbert's "Surface Simplification Using Quadric Error Metrics").
+ * every keyframe shares the result: an edge is collapsed onto one of its
+ * own vertices, so the simpler mesh keeps indexing the model's vertices
+ * and follows the model through every frame and blend between them, and
+ * the error is summed over a spread of keyframes so the mesh fits them all
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "my_math.h"
+#include "md2lod.h"
+
+/* how many keyframes the error is measured in */
+#define LOD_SAMPLE_FRAMES 8
+
+/* the upper half of a symmetric 4x4 matrix: aa ab ac ad bb bc bd cc cd dd */
+struct quadric {
+	double m[10];
+};
+
+struct collapse {
+	double cost;
+	unsigned int from, to;
+	unsigned int from_stamp, to_stamp;
+};
+
+struct tri_list {
+	unsigned int *tris;
+	unsigned int num, max;
+};
+
+struct simplifier {
+	struct md2_model *mp;
+	unsigned int num_samples;
+	float (*positions)[3]; /* num_samples frames of num_vertices */
+	struct quadric *quadrics; /* likewise */
+
+	int (*tris)[3];
+	char *dead_tris;
+	unsigned int num_live_tris;
+
+	struct tri_list *vert_tris; /* the live triangles using each vertex */
+	char *locked; /* on an open or non-manifold edge, so it mustn't move */
+	char *dead_verts;
+	unsigned int *stamps; /* bumped when a vertex changes, to spot stale collapses */
+	unsigned int *marks;
+	unsigned int mark;
+
+	struct collapse *heap;
+	unsigned int heap_size, heap_max;
+};
+
+static void
+edge_vector(float e[3], float v1[3], float v2[3])
+{
+	e[0] = v2[0] - v1[0];
+	e[1] = v2[1] - v1[1];
+	e[2] = v2[2] - v1[2];
+}
+
+static void
+add_plane(struct quadric *q, double p[4], double weight)
+{
+	q->m[0] += weight * p[0] * p[0];
+	q->m[1] += weight * p[0] * p[1];
+	q->m[2] += weight * p[0] * p[2];
+	q->m[3] += weight * p[0] * p[3];
+	q->m[4] += weight * p[1] * p[1];
+	q->m[5] += weight * p[1] * p[2];
+	q->m[6] += weight * p[1] * p[3];
+	q->m[7] += weight * p[2] * p[2];
+	q->m[8] += weight * p[2] * p[3];
+	q->m[9] += weight * p[3] * p[3];
+}
+
+/* the squared distance of v from the planes in both quadrics */
+static double
+quadric_error(struct quadric *a, struct quadric *b, float v[3])
+{
+	double m[10], x = v[0], y = v[1], z = v[2];
+	int i;
+
+	for(i = 0; i < 10; i++)
+		m[i] = a->m[i] + b->m[i];
+
+	return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x +
+	       m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y +
+	       m[7] * z * z + 2.0 * m[8] * z + m[9];
+}
+
+static float *
+sample_position(struct simplifier *s, unsigned int sample, unsigned int v)
+{
+	return s->positions[sample * s->mp->num_vertices + v];
+}
+
+static int
+add_vert_tri(struct tri_list *l, unsigned int tri)
+{
+	unsigned int *tris;
+
+	if(l->num == l->max) {
+		tris = realloc(l->tris, sizeof(unsigned int) * (l->max ? l->max * 2 : 8));
+		if(!tris)
+			return FALSE;
+		l->tris = tris;
+		l->max = l->max ? l->max * 2 : 8;
+	}
+	l->tris[l->num++] = tri;
+
+	return TRUE;
+}
+
+static void
+remove_vert_tri(struct tri_list *l, unsigned int tri)
+{
+	unsigned int i;
+
+	for(i = 0; i < l->num; i++) {
+		if(l->tris[i] == tri) {
+			l->tris[i] = l->tris[--l->num];
+			return;
+		}
+	}
+}
+
+static int
+tri_has_vert(int tri[3], unsigned int v)
+{
+	return (tri[0] == (int)v || tri[1] == (int)v || tri[2] == (int)v);
+}
+
+/* mark the vertices sharing a triangle with v; the caller bumps s->mark first */
+static void
+mark_neighbors(struct simplifier *s, unsigned int v)
+{
+	struct tri_list *l = s->vert_tris + v;
+	unsigned int i, j;
+
+	for(i = 0; i < l->num; i++) {
+		for(j = 0; j < 3; j++)
+			s->marks[(s->tris[(l->tris[i])][j])] = s->mark;
+	}
+}
+
+static void
+heap_push(struct simplifier *s, struct collapse *c)
+{
+	struct collapse *heap, tmp;
+	unsigned int i;
+
+	if(s->heap_size == s->heap_max) {
+		heap = realloc(s->heap, sizeof(struct collapse) * s->heap_max * 2);
+		if(!heap)
+			return; /* the edge just won't be collapsed */
+		s->heap = heap;
+		s->heap_max *= 2;
+	}
+
+	i = s->heap_size++;
+	s->heap[i] = *c;
+	while(i > 0 && s->heap[i].cost < s->heap[(i - 1) / 2].cost) {
+		tmp = s->heap[i];
+		s->heap[i] = s->heap[(i - 1) / 2];
+		s->heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+}
+
+static void
+heap_pop(struct simplifier *s, struct collapse *c)
+{
+	struct collapse tmp;
+	unsigned int i, child;
+
+	*c = s->heap[0];
+	s->heap[0] = s->heap[--s->heap_size];
+
+	i = 0;
+	while((child = i * 2 + 1) < s->heap_size) {
+		if(child + 1 < s->heap_size && s->heap[child + 1].cost < s->heap[child].cost)
+			child++;
+		if(s->heap[i].cost <= s->heap[child].cost)
+			break;
+		tmp = s->heap[i];
+		s->heap[i] = s->heap[child];
+		s->heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void
+push_collapse(struct simplifier *s, unsigned int from, unsigned int to, double cost)
+{
+	struct collapse c;
+
+	c.cost = cost;
+	c.from = from;
+	c.to = to;
+	c.from_stamp = s->stamps[from];
+	c.to_stamp = s->stamps[to];
+	heap_push(s, &c);
+}
+
+/*
+ * queue both ways of collapsing the edge between a and b, unless that end
+ * is locked; the cheaper one is tried first, and if it would fold the mesh
+ * over the other is still there to try
+ */
+static void
+push_edge(struct simplifier *s, unsigned int a, unsigned int b)
+{
+	double ab = 0.0, ba = 0.0;
+	unsigned int i;
+
+	if(s->locked[a] && s->locked[b])
+		return;
+
+	for(i = 0; i < s->num_samples; i++) {
+		ab += quadric_error(s->quadrics + i * s->mp->num_vertices + a, s->quadrics + i * s->mp->num_vertices + b, sample_position(s, i, b));
+		ba += quadric_error(s->quadrics + i * s->mp->num_vertices + a, s->quadrics + i * s->mp->num_vertices + b, sample_position(s, i, a));
+	}
+
+	if(!s->locked[a])
+		push_collapse(s, a, b, ab);
+	if(!s->locked[b])
+		push_collapse(s, b, a, ba);
+}
+
+/* queue a collapse for each edge from v to a vertex after it, or every edge if all is set */
+static void
+push_vert_edges(struct simplifier *s, unsigned int v, int all)
+{
+	struct tri_list *l = s->vert_tris + v;
+	unsigned int i, j, w;
+
+	s->mark++;
+	for(i = 0; i < l->num; i++) {
+		for(j = 0; j < 3; j++) {
+			w = s->tris[(l->tris[i])][j];
+			if(w == v || s->marks[w] == s->mark || (!all && w < v))
+				continue;
+			s->marks[w] = s->mark;
+			push_edge(s, v, w);
+		}
+	}
+}
+
+/*
+ * check that moving from onto to keeps the mesh a closed manifold that
+ * doesn't fold over in any of the sampled keyframes: the edge has to be
+ * shared by exactly two triangles, and the two vertices can only have
+ * the vertices opposite the edge as common neighbors
+ */
+static int
+can_collapse(struct simplifier *s, unsigned int from, unsigned int to)
+{
+	struct tri_list *l = s->vert_tris + from;
+	unsigned int i, j, k, shared, common;
+	float *v[3], e1[3], e2[3], n0[3], n1[3];
+
+	if(s->locked[from] || s->num_live_tris < 6)
+		return FALSE;
+
+	shared = 0;
+	for(i = 0; i < l->num; i++)
+		shared += tri_has_vert(s->tris[(l->tris[i])], to);
+	if(shared != 2)
+		return FALSE;
+
+	s->mark++;
+	mark_neighbors(s, from);
+	s->mark++;
+	common = 0;
+	l = s->vert_tris + to;
+	for(i = 0; i < l->num; i++) {
+		for(j = 0; j < 3; j++) {
+			unsigned int w = s->tris[(l->tris[i])][j];
+
+			if(s->marks[w] == s->mark - 1 && w != from && w != to) {
+				s->marks[w] = s->mark;
+				common++;
+			}
+		}
+	}
+	if(common != 2)
+		return FALSE;
+
+	l = s->vert_tris + from;
+	for(i = 0; i < l->num; i++) {
+		int *tri = s->tris[(l->tris[i])];
+
+		if(tri_has_vert(tri, to))
+			continue;
+
+		for(k = 0; k < s->num_samples; k++) {
+			for(j = 0; j < 3; j++)
+				v[j] = sample_position(s, k, tri[j]);
+			edge_vector(e1, v[0], v[1]);
+			edge_vector(e2, v[0], v[2]);
+			cross_product(n0, e1, e2);
+
+			for(j = 0; j < 3; j++) {
+				if(tri[j] == (int)from)
+					v[j] = sample_position(s, k, to);
+			}
+			edge_vector(e1, v[0], v[1]);
+			edge_vector(e2, v[0], v[2]);
+			cross_product(n1, e1, e2);
+
+			/* a face that had no area in this frame can't flip */
+			if(dot_product(n0, n0) > 0.0f && dot_product(n0, n1) <= 0.0f)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static int
+collapse_edge(struct simplifier *s, unsigned int from, unsigned int to)
+{
+	struct tri_list *l = s->vert_tris + from;
+	unsigned int i, j, k, t;
+
+	for(i = 0; i < l->num; i++) {
+		t = l->tris[i];
+		if(tri_has_vert(s->tris[t], to)) {
+			s->dead_tris[t] = 1;
+			s->num_live_tris--;
+			for(j = 0; j < 3; j++) {
+				if(s->tris[t][j] != (int)from)
+					remove_vert_tri(s->vert_tris + s->tris[t][j], t);
+			}
+		} else {
+			for(j = 0; j < 3; j++) {
+				if(s->tris[t][j] == (int)from)
+					s->tris[t][j] = to;
+			}
+			if(!add_vert_tri(s->vert_tris + to, t))
+				return FALSE;
+		}
+	}
+	l->num = 0;
+
+	for(k = 0; k < s->num_samples; k++) {
+		struct quadric *q = s->quadrics + k * s->mp->num_vertices;
+
+		for(j = 0; j < 10; j++)
+			q[to].m[j] += q[from].m[j];
+	}
+
+	s->dead_verts[from] = 1;
+	s->stamps[from]++;
+	s->stamps[to]++;
+	push_vert_edges(s, to, TRUE);
+
+	return TRUE;
+}
+
+/* lock the vertices of every edge that isn't shared by exactly two triangles */
+static void
+lock_open_edges(struct simplifier *s)
+{
+	struct tri_list *l;
+	unsigned int v, i, j, k, w, shared;
+
+	for(v = 0; v < s->mp->num_vertices; v++) {
+		l = s->vert_tris + v;
+		for(i = 0; i < l->num; i++) {
+			for(j = 0; j < 3; j++) {
+				w = s->tris[(l->tris[i])][j];
+				if(w == v)
+					continue;
+
+				shared = 0;
+				for(k = 0; k < l->num; k++)
+					shared += tri_has_vert(s->tris[(l->tris[k])], w);
+				if(shared != 2) {
+					s->locked[v] = 1;
+					s->locked[w] = 1;
+				}
+			}
+		}
+	}
+}
+
+static int
+setup_quadrics(struct simplifier *s)
+{
+	unsigned int i, j, k, frame;
+	double p[4], len;
+	float *v[3], e1[3], e2[3], n[3];
+
+	for(i = 0; i < s->num_samples; i++) {
+		frame = i * s->mp->num_frames / s->num_samples;
+		if(!md2_get_frame(s->mp, frame))
+			return FALSE;
+		memcpy(sample_position(s, i, 0), s->mp->f[frame].positions, sizeof(float) * 3 * s->mp->num_vertices);
+		md2_release_frame(s->mp, frame);
+
+		/* each face's plane, weighted by its area */
+		for(j = 0; j < s->mp->num_triangles; j++) {
+			for(k = 0; k < 3; k++)
+				v[k] = sample_position(s, i, s->tris[j][k]);
+			edge_vector(e1, v[0], v[1]);
+			edge_vector(e2, v[0], v[2]);
+			cross_product(n, e1, e2);
+			len = sqrt((double)n[0] * n[0] + (double)n[1] * n[1] + (double)n[2] * n[2]);
+			if(len == 0.0)
+				continue;
+
+			p[0] = n[0] / len;
+			p[1] = n[1] / len;
+			p[2] = n[2] / len;
+			p[3] = -(p[0] * v[0][0] + p[1] * v[0][1] + p[2] * v[0][2]);
+			for(k = 0; k < 3; k++)
+				add_plane(s->quadrics + i * s->mp->num_vertices + s->tris[j][k], p, len * 0.5);
+		}
+	}
+
+	return TRUE;
+}
+
+static void
+free_simplifier(struct simplifier *s)
+{
+	unsigned int i;
+
+	if(s->vert_tris) {
+		for(i = 0; i < s->mp->num_vertices; i++)
+			free(s->vert_tris[i].tris);
+	}
+	free(s->vert_tris);
+	free(s->positions);
+	free(s->quadrics);
+	free(s->tris);
+	free(s->dead_tris);
+	free(s->locked);
+	free(s->dead_verts);
+	free(s->stamps);
+	free(s->marks);
+	free(s->heap);
+}
+
+/*
+ * simplify the model's mesh down to about target triangles, returning the
+ * new triangles; open parts of the mesh are kept as they are, and a
+ * closed mesh stays closed, so it may end up with more than the target
+ */
+struct md2_triangle *
+md2_simplify(struct md2_model *mp, unsigned int target, unsigned int *num_triangles)
+{
+	struct simplifier s;
+	struct md2_triangle *t;
+	struct collapse c;
+	unsigned int i, j, n, nv = mp->num_vertices;
+
+	memset(&s, 0, sizeof(s));
+	s.mp = mp;
+	s.num_samples = (mp->num_frames < LOD_SAMPLE_FRAMES) ? mp->num_frames : LOD_SAMPLE_FRAMES;
+	s.positions = malloc(sizeof(float) * 3 * nv * s.num_samples);
+	s.quadrics = calloc(nv * s.num_samples, sizeof(struct quadric));
+	s.tris = malloc(sizeof(int) * 3 * (mp->num_triangles + 1));
+	s.dead_tris = calloc(mp->num_triangles + 1, 1);
+	s.vert_tris = calloc(nv, sizeof(struct tri_list));
+	s.locked = calloc(nv, 1);
+	s.dead_verts = calloc(nv, 1);
+	s.stamps = calloc(nv, sizeof(unsigned int));
+	s.marks = calloc(nv, sizeof(unsigned int));
+	s.heap_max = mp->num_triangles * 6 + 1;
+	s.heap = malloc(sizeof(struct collapse) * s.heap_max);
+	if(!s.positions || !s.quadrics || !s.tris || !s.dead_tris || !s.vert_tris ||
+	   !s.locked || !s.dead_verts || !s.stamps || !s.marks || !s.heap) {
+		fprintf(stderr, "Error: Couldn't allocate memory for simplifying %s\n", mp->name);
+		free_simplifier(&s);
+		return NULL;
+	}
+
+	for(i = 0; i < mp->num_triangles; i++) {
+		for(j = 0; j < 3; j++) {
+			s.tris[i][j] = mp->t[i].vertexIndices[j];
+			if(!add_vert_tri(s.vert_tris + s.tris[i][j], i)) {
+				fprintf(stderr, "Error: Couldn't allocate memory for simplifying %s\n", mp->name);
+				free_simplifier(&s);
+				return NULL;
+			}
+		}
+	}
+	s.num_live_tris = mp->num_triangles;
+
+	if(!setup_quadrics(&s)) {
+		free_simplifier(&s);
+		return NULL;
+	}
+	lock_open_edges(&s);
+	for(i = 0; i < nv; i++)
+		push_vert_edges(&s, i, FALSE);
+
+	while(s.num_live_tris > target && s.heap_size) {
+		heap_pop(&s, &c);
+		if(s.dead_verts[(c.from)] || s.dead_verts[(c.to)] ||
+		   c.from_stamp != s.stamps[(c.from)] || c.to_stamp != s.stamps[(c.to)] ||
+		   !can_collapse(&s, c.from, c.to))
+			continue;
+
+		if(!collapse_edge(&s, c.from, c.to)) {
+			fprintf(stderr, "Error: Couldn't allocate memory for simplifying %s\n", mp->name);
+			free_simplifier(&s);
+			return NULL;
+		}
+	}
+
+	t = malloc(sizeof(struct md2_triangle) * (s.num_live_tris + 1));
+	if(!t) {
+		fprintf(stderr, "Error: Couldn't allocate memory for simplifying %s\n", mp->name);
+		free_simplifier(&s);
+		return NULL;
+	}
+	for(i = 0, n = 0; i < mp->num_triangles; i++) {
+		if(s.dead_tris[i])
+			continue;
+
+		for(j = 0; j < 3; j++) {
+			t[n].vertexIndices[j] = s.tris[i][j];
+			t[n].textureIndices[j] = mp->t[i].textureIndices[j];
+		}
+		n++;
+	}
+	*num_triangles = n;
+
+	free_simplifier(&s);
+	return t;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * mipmaps for rgba or palette indexed textures, worked out once on the cpu
+ * with a box filter rather than by the driver at upload. the levels are
+ * kept one after another in the same buffer as the texture, down to 1x1,
+ * and can be saved next to the texture so they're only made the first time
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(USE_SSE) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* USE_SSE && __SSE2__ */
+#include "my_math.h"
+#include "mapfile.h"
+#include "mipmap.h"
+
+/* bump this whenever the filter changes */
+#define MIPMAP_CACHE_VERSION	2
+#define MIPMAP_CACHE_MAGIC		(('P' << 24) | ('I' << 16) | ('M' << 8) | 'T')
+#define MIPMAP_CACHE_BYTE_ORDER	0x01020304
+
+struct mipmap_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t source_size;
+	uint64_t source_hash;
+	uint32_t width;
+	uint32_t height;
+	uint32_t components;
+	uint32_t pixels_size;
+	uint64_t pixels_hash;
+};
+
+/* the size in bytes of a texture and all of its mipmaps, with components bytes a texel */
+size_t
+mipmap_size(unsigned int width, unsigned int height, unsigned int components)
+{
+	size_t size = 0;
+
+	for(;;) {
+		size += (size_t)width * height * components;
+		if(width == 1 && height == 1)
+			break;
+		if(width > 1)
+			width >>= 1;
+		if(height > 1)
+			height >>= 1;
+	}
+
+	return size;
+}
+
+/*
+ * average each 2x2 block of src into a texel of dst, which is half its
+ * size each way; once one side is down to 1, that side's texel is used
+ * twice, so it's a 2x1 average
+ */
+static void
+downsample(unsigned char *dst, const unsigned char *src, unsigned int width, unsigned int height)
+{
+	unsigned int x, y, c, dst_width, dst_height, dx, dy;
+	const unsigned char *row0, *row1;
+
+	dst_width = (width > 1) ? width >> 1 : 1;
+	dst_height = (height > 1) ? height >> 1 : 1;
+	dx = (width > 1) ? 4 : 0;
+	dy = (height > 1) ? width * 4 : 0;
+
+	for(y = 0; y < dst_height; y++) {
+		row0 = src + (size_t)y * 2 * width * 4;
+		row1 = row0 + dy;
+		x = 0;
+#if defined(USE_SSE) && defined(__SSE2__)
+		/* two texels of dst at a time, from four of each row */
+		if(dx) {
+			__m128i zero, two, a, b, lo, hi;
+
+			zero = _mm_setzero_si128();
+			two = _mm_set1_epi16(2);
+			for(; x + 2 <= dst_width; x += 2) {
+				a = _mm_loadu_si128((const __m128i *)(row0 + x * 8));
+				b = _mm_loadu_si128((const __m128i *)(row1 + x * 8));
+				lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+				hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+				lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+				_mm_storel_epi64((__m128i *)(dst + x * 4), _mm_packus_epi16(lo, zero));
+			}
+		}
+#endif /* USE_SSE && __SSE2__ */
+		for(; x < dst_width; x++) {
+			for(c = 0; c < 4; c++) {
+				dst[x * 4 + c] = (row0[x * 8 + c] + row0[x * 8 + dx + c] +
+				                  row1[x * 8 + c] + row1[x * 8 + dx + c] + 2) >> 2;
+			}
+		}
+		dst += dst_width * 4;
+	}
+}
+
+/*
+ * fill in the mipmaps after the rgba texture in pixels, which must have
+ * room for mipmap_size(width, height, 4) bytes
+ */
+void
+mipmap_generate(unsigned char *pixels, unsigned int width, unsigned int height)
+{
+	unsigned char *next;
+
+	while(width > 1 || height > 1) {
+		next = pixels + (size_t)width * height * 4;
+		downsample(next, pixels, width, height);
+		pixels = next;
+		if(width > 1)
+			width >>= 1;
+		if(height > 1)
+			height >>= 1;
+	}
+}
+
+/* the index of the palette color closest to an rgba texel */
+static unsigned char
+nearest_color(const unsigned char *texel, const unsigned char *palette)
+{
+	int i, d, best, best_dist, dist;
+
+	best = 0;
+	best_dist = 3 * 255 * 255 + 1;
+	for(i = 0; i < 256 && best_dist; i++) {
+		d = texel[0] - palette[i * 4];
+		dist = d * d;
+		d = texel[1] - palette[i * 4 + 1];
+		dist += d * d;
+		d = texel[2] - palette[i * 4 + 2];
+		dist += d * d;
+		if(dist < best_dist) {
+			best = i;
+			best_dist = dist;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * fill in the mipmaps after the palette indices in indices, which must
+ * have room for mipmap_size(width, height, 1) bytes. each is the palette
+ * color closest to the box filtered colors of the level above it
+ */
+int
+mipmap_generate_indexed(unsigned char *indices, const unsigned char *palette, unsigned int width, unsigned int height)
+{
+	unsigned char *src, *dst, *tmp;
+	unsigned int i, num;
+
+	src = malloc((size_t)width * height * 4);
+	dst = malloc(mipmap_size(width, height, 4) - (size_t)width * height * 4);
+	if(!src || !dst) {
+		fprintf(stderr, "Error: Couldn't allocate memory for mipmaps\n");
+		free(src);
+		free(dst);
+		return FALSE;
+	}
+
+	num = width * height;
+	for(i = 0; i < num; i++)
+		memcpy(src + i * 4, palette + indices[i] * 4, 4);
+
+	while(width > 1 || height > 1) {
+		downsample(dst, src, width, height);
+		indices += (size_t)width * height;
+		if(width > 1)
+			width >>= 1;
+		if(height > 1)
+			height >>= 1;
+
+		num = width * height;
+		for(i = 0; i < num; i++)
+			indices[i] = nearest_color(dst + i * 4, palette);
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	free(src);
+	free(dst);
+	return TRUE;
+}
+
+/*
+ * read a texture and its mipmaps, pixels_size bytes in all, from the
+ * cache, if the cache was made from the same source file with the same
+ * components; pixels_hash is the hash of the texture that was saved with it
+ */
+int
+mipmap_cache_load(const char *filename, size_t source_size, uint64_t source_hash, unsigned int width, unsigned int height, unsigned int components, unsigned char *pixels, size_t pixels_size, uint64_t *pixels_hash)
+{
+	struct mipmap_cache_header *h;
+	struct stat st;
+	unsigned char *data;
+	size_t size;
+
+	/* not having a cache yet isn't an error */
+	if(stat(filename, &st) == -1)
+		return FALSE;
+
+	data = map_file(filename, &size);
+	if(!data)
+		return FALSE;
+	h = (struct mipmap_cache_header *)data;
+
+	if(size != sizeof(struct mipmap_cache_header) + pixels_size ||
+	   h->magic != MIPMAP_CACHE_MAGIC || h->version != MIPMAP_CACHE_VERSION ||
+	   h->byte_order != MIPMAP_CACHE_BYTE_ORDER ||
+	   h->source_size != source_size || h->source_hash != source_hash ||
+	   h->width != width || h->height != height ||
+	   h->components != components || h->pixels_size != pixels_size) {
+		unmap_file(data, size);
+		return FALSE;
+	}
+
+	memcpy(pixels, data + sizeof(struct mipmap_cache_header), pixels_size);
+	*pixels_hash = h->pixels_hash;
+	unmap_file(data, size);
+
+	return TRUE;
+}
+
+/* save a texture and its mipmaps, pixels_size bytes in all; it's written to a temporary file first so a reader never sees half of it */
+int
+mipmap_cache_write(const char *filename, size_t source_size, uint64_t source_hash, unsigned int width, unsigned int height, unsigned int components, const unsigned char *pixels, size_t pixels_size, uint64_t pixels_hash)
+{
+	struct mipmap_cache_header h;
+
+	memset(&h, 0, sizeof(struct mipmap_cache_header));
+	h.magic = MIPMAP_CACHE_MAGIC;
+	h.version = MIPMAP_CACHE_VERSION;
+	h.byte_order = MIPMAP_CACHE_BYTE_ORDER;
+	h.source_size = source_size;
+	h.source_hash = source_hash;
+	h.width = width;
+	h.height = height;
+	h.components = components;
+	h.pixels_size = pixels_size;
+	h.pixels_hash = pixels_hash;
+
+	return replace_file(filename, &h, sizeof(struct mipmap_cache_header), pixels, pixels_size);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MIPMAP_H__
+#define __MIPMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t mipmap_size(unsigned int width, unsigned int height, unsigned int components);
+void mipmap_generate(unsigned char *pixels, unsigned int width, unsigned int height);
+int mipmap_generate_indexed(unsigned char *indices, const unsigned char *palette, unsigned int width, unsigned int height);
+int mipmap_cache_load(const char *filename, size_t source_size, uint64_t source_hash, unsigned int width, unsigned int height, unsigned int components, unsigned char *pixels, size_t pixels_size, uint64_t *pixels_hash);
+int mipmap_cache_write(const char *filename, size_t source_size, uint64_t source_hash, unsigned int width, unsigned int height, unsigned int components, const unsigned char *pixels, size_t pixels_size, uint64_t pixels_hash);
+
+#endif /* __MIPMAP_H__ */
@@ -25,6 +25,9 @@
 
 #include <stdio.h>
 #include <math.h>
+#ifdef USE_SSE
+#include <xmmintrin.h>
+#endif /* USE_SSE */
 #include "my_math.h"
 
 /* column major to row major and vice-versa */
@@ -93,6 +96,82 @@ transpose_matrix(float out[16], float m[16])
 	}
 }
 
+/*
+ * create a column major perspective projection matrix with the far plane
+ * at infinity, so that vertices with w = 0 are never clipped; the small
+ * epsilon keeps those vertices just inside the far end of the depth range
+ */
+void
+infinite_perspective_matrix(float m[16], float fovy, float aspect, float near)
+{
+	float f;
+	float epsilon = 2.4e-7f;
+	int i;
+
+	f = 1.0f / tanf(DEG2RAD(fovy) * 0.5f);
+
+	for(i = 0; i < 16; i++)
+		m[i] = 0.0f;
+
+	m[0] = f / aspect;
+	m[5] = f;
+	m[10] = epsilon - 1.0f;
+	m[11] = -1.0f;
+	m[14] = (epsilon - 2.0f) * near;
+}
+
+/* transform a point by a column major matrix, as used by OpenGL */
+void
+transform_point(float out[3], float m[16], float v[3])
+{
+	out[0] = m[0]*v[0] + m[4]*v[1] + m[8]*v[2] + m[12];
+	out[1] = m[1]*v[0] + m[5]*v[1] + m[9]*v[2] + m[13];
+	out[2] = m[2]*v[0] + m[6]*v[1] + m[10]*v[2] + m[14];
+}
+
+/*
+ * extract the six clipping planes from a combined column major
+ * projection and modelview matrix; the planes face inwards
+ */
+void
+extract_frustum_planes(float planes[6][4], float m[16])
+{
+	int i, j;
+	float len;
+
+	for(i = 0; i < 4; i++) {
+		planes[0][i] = m[i*4 + 3] + m[i*4 + 0]; /* left */
+		planes[1][i] = m[i*4 + 3] - m[i*4 + 0]; /* right */
+		planes[2][i] = m[i*4 + 3] + m[i*4 + 1]; /* bottom */
+		planes[3][i] = m[i*4 + 3] - m[i*4 + 1]; /* top */
+		planes[4][i] = m[i*4 + 3] + m[i*4 + 2]; /* near */
+		planes[5][i] = m[i*4 + 3] - m[i*4 + 2]; /* far */
+	}
+
+	for(i = 0; i < 6; i++) {
+		len = VEC_MAGNITUDE(planes[i]);
+		if(len == 0.0f)
+			continue;
+
+		for(j = 0; j < 4; j++)
+			planes[i][j] /= len;
+	}
+}
+
+/* check whether any part of a sphere is inside the planes */
+int
+sphere_in_frustum(float planes[6][4], float center[3], float radius)
+{
+	int i;
+
+	for(i = 0; i < 6; i++) {
+		if(dot_product(planes[i], center) + planes[i][3] < -radius)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 void
 normalize(float v[3])
 {
@@ -147,6 +226,30 @@ dot_product(float v1[3], float v2[3])
 #endif /* USE_3DNOW */
 }
 
+/*
+ * blend n floats from a towards b; with USE_SSE the arrays must be 16
+ * byte aligned
+ */
+void
+lerp_vectors(float *out, const float *a, const float *b, float t,
+             unsigned int n)
+{
+	unsigned int i = 0;
+#ifdef USE_SSE
+	__m128 vt, va, vb;
+
+	vt = _mm_set1_ps(t);
+	for(; i + 4 <= n; i += 4) {
+		va = _mm_load_ps(a + i);
+		vb = _mm_load_ps(b + i);
+		_mm_store_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+	}
+#endif /* USE_SSE */
+
+	for(; i < n; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
 void
 cross_product(float dst[3], float v1[3], float v2[3])
 {
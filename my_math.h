@@ -44,6 +44,10 @@
 #define sqrtf (float)sqrt
 #endif
 
+#ifndef tanf
+#define tanf (float)tan
+#endif
+
 #ifndef FALSE
 #define FALSE 0
 #endif
@@ -57,8 +61,13 @@
 void swap_matrix_major(float m[16]);
 void multiply_matrix(float out[16], float m1[16], float m2[16]);
 void transpose_matrix(float out[16], float m[16]);
+void infinite_perspective_matrix(float m[16], float fovy, float aspect, float near);
+void transform_point(float out[3], float m[16], float v[3]);
+void extract_frustum_planes(float planes[6][4], float m[16]);
+int sphere_in_frustum(float planes[6][4], float center[3], float radius);
 void normalize(float v[3]);
 float dot_product(float v1[3], float v2[3]);
+void lerp_vectors(float *out, const float *a, const float *b, float t, unsigned int n);
 void cross_product(float dst[3], float v1[3], float v2[3]);
 void setup_plane(float plane[4], float v1[3], float v2[3], float v3[3], int normalize_dir);
 
@@ -25,8 +25,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "endian.h"
 #include "my_math.h"
+#include "mapfile.h"
+#include "pcx.h"
 
 struct pcx_header {
 	uint8_t manufacturer;
@@ -49,151 +52,250 @@ struct pcx_header {
 	uint8_t filler[54];
 };
 
+#define PCX_PALETTE_SIZE 769 /* a marker byte, then 256 rgb triples */
+
+/* an 8-bit pcx image in memory */
+struct pcx_image {
+	int width, height;
+	unsigned int bytesperline;
+	const uint8_t *data; /* the run-length encoded scanlines */
+	const uint8_t *end;
+	const uint8_t *palette;
+};
+
+/* where the decoder is in the image data; runs can carry on into the next scanline */
+struct pcx_decoder {
+	const uint8_t *p, *end;
+	unsigned int run;
+	uint8_t byte;
+};
+
 static int
-read_scanline(FILE *fp, unsigned char *planes[], unsigned int num_planes,
+parse_pcx(const void *buffer, size_t size, struct pcx_image *img)
+{
+	struct pcx_header header;
+
+	if(size < sizeof(struct pcx_header)) {
+		fprintf(stderr, "Error: Not enough data for a pcx header\n");
+		return FALSE;
+	}
+	memcpy(&header, buffer, sizeof(struct pcx_header));
+	header.xmin = le_to_native_short(header.xmin);
+	header.ymin = le_to_native_short(header.ymin);
+	header.xmax = le_to_native_short(header.xmax);
+	header.ymax = le_to_native_short(header.ymax);
+	header.bytesperline = le_to_native_ushort(header.bytesperline);
+
+	if(header.bitsperpixel != 8) {
+		fprintf(stderr, "Error: Unsupported number of bits per pixel\n");
+		return FALSE;
+	}
+	if(header.colorplanes != 1) {
+		fprintf(stderr, "Error: Unsupported number of color planes\n");
+		return FALSE;
+	}
+
+	img->width = header.xmax - header.xmin + 1;
+	img->height = header.ymax - header.ymin + 1;
+	img->bytesperline = header.bytesperline;
+
+	/* a run is two bytes for at most 63 pixels, so the data has to be big enough */
+	if(img->width < 1 || img->height < 1 || header.bytesperline < img->width ||
+	   size < sizeof(struct pcx_header) + PCX_PALETTE_SIZE ||
+	   (size_t)header.bytesperline * img->height / 63 > size - sizeof(struct pcx_header) - PCX_PALETTE_SIZE) {
+		fprintf(stderr, "Error: Bad dimensions (%dx%d)\n", img->width, img->height);
+		return FALSE;
+	}
+
+	img->data = (const uint8_t *)buffer + sizeof(struct pcx_header);
+	img->end = (const uint8_t *)buffer + size - PCX_PALETTE_SIZE;
+	if(img->end[0] != 12) {
+		fprintf(stderr, "Error: This ain't a palette\n");
+		return FALSE;
+	}
+	img->palette = img->end + 1;
+
+	return TRUE;
+}
+
+/* decode the next scanline; literal spans are copied and runs are filled in whole */
+static int
+read_scanline(struct pcx_decoder *d, unsigned char *line,
               unsigned int bytesperline)
 {
-	unsigned int i, j;
-	unsigned int p, count;
-	uint8_t byte;
+	const uint8_t *literal;
+	unsigned int i, count;
 
-	for(p = 0; p < num_planes; p++) {
-		for(i = 0; i < bytesperline;) {
-			if(fread(&byte, 1, 1, fp) != 1)
-				return FALSE;
+	for(i = 0; i < bytesperline;) {
+		if(d->run) {
+			count = (d->run < bytesperline - i) ? d->run : bytesperline - i;
+			memset(line + i, d->byte, count);
+			d->run -= count;
+			i += count;
+			continue;
+		}
+
+		if(d->p >= d->end)
+			return FALSE;
 
-			if(byte >> 6 == 0x3) {
-				count = byte & ~(0x3 << 6);
-				if(count == 0)
-					return FALSE;
-				if(fread(&byte, 1, 1, fp) != 1)
-					return FALSE;
-			} else {
-				count = 1;
-			}
-
-			for(j = 0; j < count; j++)
-				planes[p][i++] = byte;
-
-			if(i >= bytesperline) {
-				p++;
-				if(p >= num_planes)
-					return TRUE;
-				i = 0;
-			}
+		if(*d->p >= 0xc0) {
+			d->run = *d->p & 0x3f;
+			if(d->run == 0 || d->p + 1 >= d->end)
+				return FALSE;
+			d->byte = d->p[1];
+			d->p += 2;
+		} else {
+			/* bytes without the run bits set stand for themselves */
+			literal = d->p;
+			while(d->p < d->end && *d->p < 0xc0 && (unsigned int)(d->p - literal) < bytesperline - i)
+				d->p++;
+			count = d->p - literal;
+			memcpy(line + i, literal, count);
+			i += count;
 		}
 	}
 
 	return TRUE;
 }
 
-unsigned char *
-load_pcx_data_8(FILE *fp, int width, int height,
-                unsigned int bytesperline)
+/* get the size of a pcx image in memory, without decoding it */
+int
+pcx_get_size(const void *buffer, size_t size, unsigned int *widthp,
+             unsigned int *heightp)
 {
-	int i, j;
-	int max;
-	unsigned char *data, *p_data;
-	unsigned char *line, *planes[1];
-	unsigned int current_line = 0;
-	uint8_t byte;
-	unsigned char palette[256][3];
+	struct pcx_image img;
 
-	p_data = malloc(sizeof(unsigned char) * width * height);
-	if(!p_data)
-		return NULL;
+	if(!parse_pcx(buffer, size, &img))
+		return FALSE;
 
-	line = malloc(sizeof(unsigned char) * bytesperline);
-	planes[0] = line;
+	*widthp = img.width;
+	*heightp = img.height;
+	return TRUE;
+}
 
-	while(current_line < height) {
-		if(read_scanline(fp, planes, 1, bytesperline) == FALSE) {
-			free(p_data);
-			free(line);
-			return NULL;
-		}
+/* get the 256 colors of a pcx image in memory, as rgba with an opaque alpha */
+int
+pcx_get_palette(const void *buffer, size_t size, unsigned char *palette)
+{
+	struct pcx_image img;
+	int i;
 
-		for(i = 0; i < width; i++)
-			p_data[width * current_line + i] = planes[0][i];
+	if(!parse_pcx(buffer, size, &img))
+		return FALSE;
 
-		current_line++;
+	for(i = 0; i < 256; i++) {
+		palette[i * 4] = img.palette[i * 3];
+		palette[i * 4 + 1] = img.palette[i * 3 + 1];
+		palette[i * 4 + 2] = img.palette[i * 3 + 2];
+		palette[i * 4 + 3] = 255;
 	}
 
-	/* read palette */
-	fseek(fp, -769, SEEK_END);
-	fread(&byte, 1, 1, fp);
-	if(byte != 12) {
-		fprintf(stderr, "Error: This ain't a palette\n");
-		free(p_data);
-		free(line);
-		return NULL;
+	return TRUE;
+}
+
+/*
+ * decode a pcx image in memory straight into pixels, with 3 (rgb) or 4
+ * (rgba, with an opaque alpha) components for each pixel, or 1 for the
+ * palette indices as they are. each scanline is expanded through the
+ * palette as soon as it's decoded, so nothing image-sized is allocated;
+ * pixels can be a mapped pixel unpack buffer
+ */
+int
+pcx_decode(const void *buffer, size_t size, unsigned char *pixels,
+           unsigned int components)
+{
+	struct pcx_image img;
+	struct pcx_decoder d;
+	unsigned char *line, *out;
+	uint32_t lut[256];
+	unsigned char *entry;
+	int x, y;
+
+	if(components != 1 && components != 3 && components != 4) {
+		fprintf(stderr, "Error: Can't decode pcx images to %d components\n", components);
+		return FALSE;
 	}
-	for(i = 0; i < 256; i++)
-		fread(palette[i], 3, 1, fp);
+	if(!parse_pcx(buffer, size, &img))
+		return FALSE;
 
-	data = malloc(sizeof(unsigned char) * width * height * 3);
-	if(!data) {
-		free(p_data);
-		free(line);
-		return NULL;
+	/* each palette entry as the bytes of a pixel, so a pixel is one lookup and one store */
+	for(x = 0; x < 256; x++) {
+		entry = (unsigned char *)&(lut[x]);
+		entry[0] = img.palette[x * 3];
+		entry[1] = img.palette[x * 3 + 1];
+		entry[2] = img.palette[x * 3 + 2];
+		entry[3] = 255;
 	}
 
-	max = width * height;
-	j = 0;
-	for(i = 0; i < max; i++) {
-		data[j++] = palette[(p_data[i])][0];
-		data[j++] = palette[(p_data[i])][1];
-		data[j++] = palette[(p_data[i])][2];
+	line = malloc(sizeof(unsigned char) * img.bytesperline);
+	if(!line)
+		return FALSE;
+
+	d.p = img.data;
+	d.end = img.end;
+	d.run = 0;
+	d.byte = 0;
+	out = pixels;
+	for(y = 0; y < img.height; y++) {
+		if(!read_scanline(&d, line, img.bytesperline)) {
+			free(line);
+			return FALSE;
+		}
+
+		if(components == 1) {
+			memcpy(out, line, img.width);
+			out += img.width;
+		} else if(components == 4) {
+			for(x = 0; x < img.width; x++, out += 4)
+				memcpy(out, &(lut[(line[x])]), 4);
+		} else {
+			for(x = 0; x < img.width; x++, out += 3)
+				memcpy(out, &(lut[(line[x])]), 3);
+		}
 	}
 
-	free(p_data);
 	free(line);
-	return data;
+	return TRUE;
 }
 
+/* decode an 8-bit pcx image that's already in memory into rgb */
 unsigned char *
-read_pcx(const char *filename, unsigned int *widthp, unsigned int *heightp)
+read_pcx_buffer(const void *buffer, size_t size, unsigned int *widthp,
+                unsigned int *heightp)
 {
-	FILE *fp;
-	struct pcx_header header;
 	unsigned char *data;
-	int width, height;
+	unsigned int width, height;
 
-	fp = fopen(filename, "rb");
-	if(!fp) {
-		fprintf(stderr, "Error: Couldn't open %s for reading\n", filename);
+	if(!pcx_get_size(buffer, size, &width, &height))
 		return NULL;
-	}
 
-	fread(&header, sizeof(struct pcx_header), 1, fp);
-	header.xmin = le_to_native_short(header.xmin);
-	header.ymin = le_to_native_short(header.ymin);
-	header.xmax = le_to_native_short(header.xmax);
-	header.ymax = le_to_native_short(header.ymax);
-	header.bytesperline = le_to_native_ushort(header.bytesperline);
-
-	if(header.bitsperpixel != 8) {
-		fprintf(stderr, "Error: %s has unsupported number of bits per pixel\n", filename);
-		return NULL;
-	}
-	if(header.colorplanes != 1) {
-		fprintf(stderr, "Error: %s has unsupported number of color planes\n", filename);
+	data = malloc(sizeof(unsigned char) * width * (size_t)height * 3);
+	if(!data)
 		return NULL;
-	}
-
-	width = header.xmax - header.xmin + 1;
-	height = header.ymax - header.ymin + 1;
 
-	if(width < 1 || height < 1) {
-		fprintf(stderr, "Error: %s has bad dimensions (%dx%d)\n", filename, width, height);
+	if(!pcx_decode(buffer, size, data, 3)) {
+		free(data);
 		return NULL;
 	}
 
-	data = load_pcx_data_8(fp, width, height, header.bytesperline);
-
-	fclose(fp);
 	*widthp = width;
 	*heightp = height;
+	return data;
+}
+
+unsigned char *
+read_pcx(const char *filename, unsigned int *widthp, unsigned int *heightp)
+{
+	unsigned char *data;
+	void *file;
+	size_t size;
+
+	file = map_file(filename, &size);
+	if(!file)
+		return NULL;
+
+	data = read_pcx_buffer(file, size, widthp, heightp);
+	unmap_file(file, size);
 
 	if(!data)
 		fprintf(stderr, "Error: Unable to load %s\n", filename);
@@ -26,6 +26,12 @@
 #ifndef __PCX_H__
 #define __PCX_H__
 
+#include <stddef.h>
+
 unsigned char *read_pcx(const char *filename, unsigned int *widthp, unsigned int *heightp);
+unsigned char *read_pcx_buffer(const void *buffer, size_t size, unsigned int *widthp, unsigned int *heightp);
+int pcx_get_size(const void *buffer, size_t size, unsigned int *widthp, unsigned int *heightp);
+int pcx_get_palette(const void *buffer, size_t size, unsigned char *palette);
+int pcx_decode(const void *buffer, size_t size, unsigned char *pixels, unsigned int components);
 
 #endif /* __PCX_H__ */
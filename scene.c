@@ -23,25 +23,35 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define GL_GLEXT_PROTOTYPES
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
 #include "my_math.h"
 #include "lighting.h"
-#include "pcx.h"
+#include "shader.h"
 
 #include "md2.h"
+#include "assets.h"
+#include "shadowmap.h"
+#include "textures.h"
+#include "threads.h"
 
 #define USE_STENCIL
 
 int light = 1;
+int shadow_maps = 0; /* shadows from depth cube maps rather than stencil volumes */
+int gpu_shadows = 0; /* stencil volumes extruded by a vertex shader, unbounded, rather than on the cpu */
 
 struct surface {
 	int occluder;
-	int tex_num;
+	struct texture *texture;
 
 	float texcoords[4][2];
 	float vertices[4][3];
@@ -60,52 +70,267 @@ static float light_rot[3] = { 0.0f, 0.0f, 0.0f };
 static float cam_pos[3] = { 0.0f, 0.0f, 0.0f };
 static float cam_rot[3] = { 0.0f, -180.0f, 0.0f };
 
+/* the model's instances, and the shadow state each of them has for each light */
+struct instance_shadows {
+	struct md2_shadow *sp[3];
+	char casts[3];
+	char caps[3];
+	struct md2_model *lod; /* the mesh the instance casts its shadows with */
+	float caster_key[9]; /* the pose and placement the shadow maps last saw */
+
+	/*
+	 * occlusion queries on the box around the instance, then on the box
+	 * its shadow from each light can fall in. results are picked up a
+	 * frame later, so nothing waits on them
+	 */
+	unsigned int queries[4];
+	char queried[4];
+	char occluded[4];
+	char in_frustum;
+};
+
 static struct md2_model *m = NULL;
+static struct md2_instance *instances = NULL;
+static struct instance_shadows *shadows = NULL;
+static unsigned int num_instances = 0;
+
+/* an instance's shadow volume to build for a light, on a worker thread */
+struct shadow_job {
+	unsigned int instance;
+	int light;
+};
+
+static struct shadow_job *jobs = NULL;
+
+/* animations given to instances after the first */
+static unsigned int instance_anims[] = {
+	ANIM_STAND, ANIM_WAVE, ANIM_TAUNT, ANIM_FLIPOFF, ANIM_CRSTAND, ANIM_ATTACK
+};
+
+static float scene_mins[3], scene_maxs[3];
+
+static int shadow_shader = 0; /* whether gpu_shadows can be used */
+
+/* a map for each light, and a version that changes whenever any instance does */
+static struct shadow_map *maps[3] = { NULL, NULL, NULL };
+static unsigned int casters_version = 0;
+
+/* the textures the scene uses, and the files they're from */
+#define TEXTURE_FLOOR	0
+#define TEXTURE_CEILING	1
+#define TEXTURE_WALL	2
+#define TEXTURE_SKIN	3
+#define NUM_TEXTURES	4
+
+static char *texture_files[NUM_TEXTURES] = { "data/floor.pcx", "data/ceiling.pcx", "data/wall.pcx", NULL };
+static struct texture *textures[NUM_TEXTURES] = { NULL, NULL, NULL, NULL };
+
+/* when loading started, in ms, and whether a frame has been shown since */
+static int load_start_time = 0;
+static int first_frame_shown = 0;
 
 static void
-load_texture(int tex_num, char *filename)
+free_instances()
 {
-	unsigned int width, height;
-	unsigned char *data;
+	unsigned int i, j;
+
+	for(i = 0; i < num_instances; i++) {
+		md2_instance_destroy(&(instances[i]));
+		for(j = 0; j < 3; j++)
+			md2_shadow_free(shadows[i].sp[j]);
+		if(shadows[i].queries[0])
+			glDeleteQueries(4, shadows[i].queries);
+	}
 
-	data = read_pcx(filename, &width, &height);
-	if(!data)
-		exit(1);
+	if(instances)
+		free(instances);
+	if(shadows)
+		free(shadows);
+	if(jobs)
+		free(jobs);
+	instances = NULL;
+	shadows = NULL;
+	jobs = NULL;
+	num_instances = 0;
+}
 
-	glBindTexture(GL_TEXTURE_2D, tex_num);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+/*
+ * simpler shadow casters for instances far from the camera and the lights:
+ * half the triangles from SHADOW_LOD_DISTANCE on, and a quarter from twice
+ * that. a player model is under 3 units tall, as far apart as the
+ * instances are placed, so these are about four and eight models away
+ */
+#define SHADOW_LOD_DISTANCE 12.0f
 
-	free(data);
+static void
+add_shadow_lods(struct md2_model *mp)
+{
+	md2_add_shadow_lod(mp, mp->num_triangles / 2, SHADOW_LOD_DISTANCE);
+	md2_add_shadow_lod(mp, mp->num_triangles / 4, SHADOW_LOD_DISTANCE * 2.0f);
 }
 
+/*
+ * start loading the surfaces' textures, and the model and its skin if
+ * there is one, in the background. this can be called before there's a
+ * gl context, so the loading overlaps setting one up
+ */
 void
-scene_load_model(char *md2_filename, char *pcx_filename)
+scene_start_loading(char *md2_filename, char *pcx_filename)
 {
-	if(m)
-		md2_free(m);
+	int i;
+
+	load_start_time = glutGet(GLUT_ELAPSED_TIME);
+
+	/* the pool is used when loading too */
+	threads_init(0);
+
+	/* the model first, since it's usually the slowest */
+	if(md2_filename && pcx_filename) {
+		assets_add_model(md2_filename, 0, add_shadow_lods);
+		texture_files[TEXTURE_SKIN] = pcx_filename;
+	}
+
+	/* textures that are already loaded are just shared */
+	for(i = 0; i < NUM_TEXTURES; i++) {
+		if(!texture_files[i])
+			continue;
+		textures[i] = textures_get(texture_files[i]);
+		if(!textures[i]) {
+#ifdef USE_INDEXED_TEXTURES
+			assets_add_indexed_texture(texture_files[i], i);
+#else
+			assets_add_texture(texture_files[i], i);
+#endif /* USE_INDEXED_TEXTURES */
+		}
+	}
+
+	assets_start();
+}
 
-	m = md2_load(md2_filename);
-	if(!m)
+/*
+ * place num copies of the model in a grid around the middle of the room;
+ * the first is where the single model used to be
+ */
+static void
+place_instances(int num)
+{
+	float pos[3], rot[3];
+	unsigned int i, j, cols, rows;
+
+	if(num < 1)
+		num = 1;
+	instances = malloc(sizeof(struct md2_instance) * num);
+	shadows = malloc(sizeof(struct instance_shadows) * num);
+	jobs = malloc(sizeof(struct shadow_job) * num * 3);
+	if(!instances || !shadows || !jobs) {
+		fprintf(stderr, "Error: Couldn't allocate memory for %d instances\n", num);
 		exit(1);
+	}
+
+	cols = 1;
+	while(cols * cols < (unsigned int)num)
+		cols++;
+	rows = (num + cols - 1) / cols;
+	for(i = 0; i < (unsigned int)num; i++) {
+		pos[0] = ((float)(i % cols) - (float)(cols - 1) * 0.5f) * 3.0f;
+		pos[1] = -0.8f;
+		pos[2] = ((float)(i / cols) - (float)(rows - 1) * 0.5f) * 3.0f + 2.0f;
+		rot[0] = -90.0f;
+		rot[1] = -90.0f + (float)(i * 37 % 360);
+		rot[2] = 0.0f;
+
+		if(!md2_instance_init(&(instances[i]), m, pos, rot))
+			exit(1);
+		num_instances++;
+
+		if(i > 0) {
+			md2_player_set_animation(instances[i].player, instance_anims[i % (sizeof(instance_anims) / sizeof(unsigned int))]);
+			md2_player_update(instances[i].player, (float)i * 0.13f);
+		}
+
+		for(j = 0; j < 3; j++) {
+			shadows[i].sp[j] = md2_shadow_create(m);
+			if(!shadows[i].sp[j])
+				exit(1);
+		}
+		shadows[i].caster_key[0] = -1.0f;
+
+		memset(shadows[i].queries, 0, sizeof(shadows[i].queries));
+		memset(shadows[i].queried, 0, sizeof(shadows[i].queried));
+		memset(shadows[i].occluded, 0, sizeof(shadows[i].occluded));
+		if(queries_supported())
+			glGenQueries(4, shadows[i].queries);
+	}
 
 	glEnable(GL_TEXTURE_2D);
-	load_texture(4, pcx_filename);
+}
+
+/*
+ * upload the textures as they finish loading, then place num copies of
+ * the model if one was loaded; needs the gl context
+ */
+void
+scene_finish_loading(int num)
+{
+	struct asset *ap, *slowest = NULL;
+	int i;
+
+	while((ap = assets_next_loaded()) != NULL) {
+		if(ap->failed)
+			exit(1);
+
+		if(ap->type != ASSET_MODEL) {
+			textures[ap->id] = textures_create(ap->filename, ap->width, ap->height, ap->pixels, ap->palette, ap->hash);
+			free(ap->pixels);
+			ap->pixels = ap->palette = NULL;
+			if(!textures[ap->id])
+				exit(1);
+
+			/* anything else using the same file shares it */
+			for(i = ap->id + 1; i < NUM_TEXTURES; i++) {
+				if(!textures[i] && texture_files[i] && strcmp(texture_files[i], ap->filename) == 0)
+					textures[i] = textures_get(ap->filename);
+			}
+		} else {
+			m = ap->mp;
+		}
+
+		if(!slowest || ap->seconds > slowest->seconds)
+			slowest = ap;
+	}
+
+	if(slowest)
+		printf("Assets loaded in %d ms, slowest was %s at %d ms\n",
+		       glutGet(GLUT_ELAPSED_TIME) - load_start_time, slowest->filename,
+		       (int)(slowest->seconds * 1000.0));
+	assets_finish();
+
+	if(m)
+		place_instances(num);
 }
 
 void
 scene_free()
 {
+	int i;
+
+	threads_shutdown();
+	free_instances();
 	if(m)
 		md2_free(m);
 	if(surfaces)
 		free(surfaces);
 
+	for(i = 0; i < 3; i++)
+		shadowmap_free(maps[i]);
+	shadowmap_shutdown();
+
+	for(i = 0; i < NUM_TEXTURES; i++) {
+		textures_release(textures[i]);
+		textures[i] = NULL;
+	}
+	textures_shutdown();
+
 	destroy_light(lights[0]);
 	destroy_light(lights[1]);
 	destroy_light(lights[2]);
@@ -140,6 +365,499 @@ render_stencil_shadow()
 	glDisable(GL_STENCIL_TEST);
 }
 
+/*
+ * the pyramid formed by a light and the near plane rectangle, in eye
+ * space; an occluder whose bounding sphere is outside it can't shadow the
+ * near plane, so its shadow volume can be rendered with the depth-pass
+ * technique and doesn't need to be capped
+ */
+struct caps_pyramid {
+	int always; /* the light is on the near plane, so nothing's outside */
+	float planes[5][4]; /* facing in */
+};
+
+/* set up the pyramid for a light, once for all the occluders it has */
+static void
+setup_caps_pyramid(struct caps_pyramid *cp, float mv[16], float proj[16], float light_pos[3])
+{
+	float l[3];
+	float rect[4][3];
+	float near, w, h, d;
+	int i;
+
+	/* do everything in eye space, where the near rectangle is simple */
+	transform_point(l, mv, light_pos);
+
+	near = proj[14] / (proj[10] - 1.0f);
+	w = near / proj[0];
+	h = near / proj[5];
+
+	rect[0][0] = -w; rect[0][1] = -h; rect[0][2] = -near;
+	rect[1][0] = w; rect[1][1] = -h; rect[1][2] = -near;
+	rect[2][0] = w; rect[2][1] = h; rect[2][2] = -near;
+	rect[3][0] = -w; rect[3][1] = h; rect[3][2] = -near;
+
+	/* near plane, facing the light */
+	d = -l[2] - near;
+	cp->always = (d > -0.001f && d < 0.001f);
+	if(cp->always)
+		return;
+	cp->planes[0][0] = 0.0f;
+	cp->planes[0][1] = 0.0f;
+	cp->planes[0][2] = (d > 0.0f) ? -1.0f : 1.0f;
+	cp->planes[0][3] = (d > 0.0f) ? -near : near;
+
+	/* planes through the light and each edge of the near rectangle */
+	for(i = 0; i < 4; i++) {
+		setup_plane(cp->planes[i + 1], l, rect[i], rect[(i + 1) % 4], TRUE);
+		d = -cp->planes[i + 1][2] * near + cp->planes[i + 1][3];
+		if(d < 0.0f) {
+			cp->planes[i + 1][0] = -cp->planes[i + 1][0];
+			cp->planes[i + 1][1] = -cp->planes[i + 1][1];
+			cp->planes[i + 1][2] = -cp->planes[i + 1][2];
+			cp->planes[i + 1][3] = -cp->planes[i + 1][3];
+		}
+	}
+}
+
+/* check whether the near plane rectangle can be in the shadow of an occluder bounded by the given sphere */
+static int
+shadow_needs_caps(struct caps_pyramid *cp, float mv[16], float center[3], float radius)
+{
+	float c[3];
+	int i;
+
+	if(cp->always)
+		return TRUE;
+
+	transform_point(c, mv, center);
+	for(i = 0; i < 5; i++) {
+		if(dot_product(cp->planes[i], c) + cp->planes[i][3] < -radius)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * get the screen rectangle, as { x1, y1, x2, y2 }, that contains the part
+ * of the scene lit by the light; returns FALSE if none of it is on the
+ * screen
+ */
+static int
+get_light_scissor(float light_pos[3], float radius, int rect[4])
+{
+	float mv[16], proj[16], mvp[16];
+	float mins[3], maxs[3];
+	float x1, y1, x2, y2;
+	int viewport[4];
+	int i, j;
+
+	/* the part of the light's sphere that's inside the scene */
+	for(i = 0; i < 3; i++) {
+		mins[i] = light_pos[i] - radius;
+		if(mins[i] < scene_mins[i])
+			mins[i] = scene_mins[i];
+
+		maxs[i] = light_pos[i] + radius;
+		if(maxs[i] > scene_maxs[i])
+			maxs[i] = scene_maxs[i];
+
+		if(mins[i] > maxs[i])
+			return FALSE;
+	}
+
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	glGetFloatv(GL_PROJECTION_MATRIX, proj);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	multiply_matrix(mvp, mv, proj);
+
+	x1 = y1 = 1.0f;
+	x2 = y2 = -1.0f;
+	for(i = 0; i < 8; i++) {
+		float v[4], c[4];
+
+		v[0] = (i & 1) ? maxs[0] : mins[0];
+		v[1] = (i & 2) ? maxs[1] : mins[1];
+		v[2] = (i & 4) ? maxs[2] : mins[2];
+		v[3] = 1.0f;
+
+		for(j = 0; j < 4; j++)
+			c[j] = mvp[j]*v[0] + mvp[4 + j]*v[1] + mvp[8 + j]*v[2] + mvp[12 + j]*v[3];
+
+		/* a corner behind the viewer; don't bother clipping */
+		if(c[3] < 0.001f) {
+			x1 = y1 = -1.0f;
+			x2 = y2 = 1.0f;
+			break;
+		}
+
+		c[0] /= c[3];
+		c[1] /= c[3];
+		if(c[0] < x1)
+			x1 = c[0];
+		if(c[0] > x2)
+			x2 = c[0];
+		if(c[1] < y1)
+			y1 = c[1];
+		if(c[1] > y2)
+			y2 = c[1];
+	}
+
+	if(x1 < -1.0f)
+		x1 = -1.0f;
+	if(y1 < -1.0f)
+		y1 = -1.0f;
+	if(x2 > 1.0f)
+		x2 = 1.0f;
+	if(y2 > 1.0f)
+		y2 = 1.0f;
+	if(x1 >= x2 || y1 >= y2)
+		return FALSE;
+
+	rect[0] = viewport[0] + (int)floorf((x1 + 1.0f) * 0.5f * viewport[2]);
+	rect[1] = viewport[1] + (int)floorf((y1 + 1.0f) * 0.5f * viewport[3]);
+	rect[2] = viewport[0] + (int)ceilf((x2 + 1.0f) * 0.5f * viewport[2]);
+	rect[3] = viewport[1] + (int)ceilf((y2 + 1.0f) * 0.5f * viewport[3]);
+
+	return TRUE;
+}
+
+/*
+ * check whether the shadow cast by the sphere can be in the frustum; the
+ * volume is inside the cone from the light that touches the sphere, and
+ * doesn't reach much past the light's radius, so it's inside the hull of
+ * the sphere and one around the cone's far end
+ */
+static int
+shadow_in_frustum(float planes[6][4], float light_pos[3], float light_radius,
+                  float center[3], float radius)
+{
+	float far_center[3], far_radius, far_dist, d[3], dist;
+	int i;
+
+	d[0] = center[0] - light_pos[0];
+	d[1] = center[1] - light_pos[1];
+	d[2] = center[2] - light_pos[2];
+	dist = VEC_MAGNITUDE(d);
+	if(dist <= radius * 1.01f)
+		return sphere_in_frustum(planes, light_pos, light_radius + radius);
+
+	far_dist = light_radius + radius;
+	far_center[0] = light_pos[0] + d[0] / dist * far_dist;
+	far_center[1] = light_pos[1] + d[1] / dist * far_dist;
+	far_center[2] = light_pos[2] + d[2] / dist * far_dist;
+	far_radius = far_dist * radius / sqrtf(dist * dist - radius * radius);
+
+	for(i = 0; i < 6; i++) {
+		if(dot_product(planes[i], center) + planes[i][3] < -radius &&
+		   dot_product(planes[i], far_center) + planes[i][3] < -far_radius)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * find the instance's silhouette and build its volume; this only reads
+ * the shared model and the light, and only writes the instance's own
+ * shadow state for the light, so jobs can run at the same time
+ */
+static void
+build_shadow_job(void *data, unsigned int n)
+{
+	struct shadow_job *job = (struct shadow_job *)data + n;
+	struct md2_instance *ip = instances + job->instance;
+	struct md2_shadow *sp = shadows[job->instance].sp[job->light];
+	float light_pos[3];
+
+	get_light_position(lights[job->light], light_pos);
+	md2_calculate_visible_tris(shadows[job->instance].lod, sp, &(ip->player->pose), ip->pos, ip->rot, light_pos);
+	md2_build_shadow_volume(shadows[job->instance].lod, sp, &(ip->player->pose), ip->pos, ip->rot, light_pos, get_light_radius(lights[job->light]), shadows[job->instance].caps[job->light]);
+}
+
+/* light a visible instance's vertices, on a worker thread */
+static void
+light_instance(void *data, unsigned int i)
+{
+	struct md2_instance *ip = instances + i;
+
+	/* the same ambient light the lightmaps have */
+	if(ip->visible)
+		md2_player_light(ip->player, ip->pos, ip->rot, 64.0f / 255.0f);
+}
+
+static void
+render_instance(struct md2_instance *ip)
+{
+	glPushMatrix();
+	glTranslatef(ip->pos[0], ip->pos[1], ip->pos[2]);
+	glRotatef(ip->rot[2], 0.0f, 0.0f, -1.0f);
+	glRotatef(ip->rot[1], 0.0f, 1.0f, 0.0f);
+	glRotatef(ip->rot[0], 1.0f, 0.0f, 0.0f);
+	md2_render(m, &(ip->player->pose));
+	glPopMatrix();
+}
+
+/* move to a new version of the casters if any instance has moved or changed its pose */
+static void
+update_casters_version()
+{
+	struct md2_instance *ip;
+	float key[9];
+	unsigned int i;
+	int changed = 0;
+
+	for(i = 0; i < num_instances; i++) {
+		ip = instances + i;
+		key[0] = (float)ip->player->pose.frame;
+		key[1] = (float)ip->player->pose.next_frame;
+		key[2] = ip->player->pose.lerp;
+		memcpy(key + 3, ip->pos, sizeof(float) * 3);
+		memcpy(key + 6, ip->rot, sizeof(float) * 3);
+		if(memcmp(key, shadows[i].caster_key, sizeof(key)) != 0) {
+			memcpy(shadows[i].caster_key, key, sizeof(key));
+			changed = 1;
+		}
+	}
+
+	if(changed)
+		casters_version++;
+}
+
+/*
+ * render the maps of the lights that have moved or whose casters have changed, then
+ * darken the surfaces where they're shadowed
+ */
+static void
+render_shadow_maps()
+{
+	struct md2_instance *ip;
+	float light_pos[3], light_radius, d[3];
+	unsigned int i;
+	int j, face;
+
+	for(j = 0; j < 3; j++) {
+		get_light_position(lights[j], light_pos);
+		light_radius = get_light_radius(lights[j]);
+		if(!shadowmap_needs_update(maps[j], light_pos, light_radius, casters_version))
+			continue;
+
+		shadowmap_begin(maps[j]);
+		for(face = 0; face < 6; face++) {
+			shadowmap_set_face(maps[j], face);
+			for(i = 0; i < num_instances; i++) {
+				ip = instances + i;
+				d[0] = light_pos[0] - ip->center[0];
+				d[1] = light_pos[1] - ip->center[1];
+				d[2] = light_pos[2] - ip->center[2];
+				if(VEC_MAGNITUDE(d) <= light_radius + ip->radius)
+					render_instance(ip);
+			}
+		}
+		shadowmap_end();
+	}
+
+	shadowmap_begin_receivers(maps, 3);
+	for(i = 0; i < num_surfaces; i++) {
+		glBegin(GL_QUADS);
+			glVertex3fv(surfaces[i].vertices[0]);
+			glVertex3fv(surfaces[i].vertices[1]);
+			glVertex3fv(surfaces[i].vertices[2]);
+			glVertex3fv(surfaces[i].vertices[3]);
+		glEnd();
+	}
+	shadowmap_end_receivers();
+}
+
+/*
+ * get the box the shadow of a sphere can fall in: the sphere and where
+ * shadow_in_frustum() puts the far end of its shadow, kept in the scene
+ */
+static void
+get_shadow_box(float light_pos[3], float light_radius, float center[3],
+               float radius, float mins[3], float maxs[3])
+{
+	float far_center[3], far_radius, far_dist, d[3], dist;
+	int i;
+
+	d[0] = center[0] - light_pos[0];
+	d[1] = center[1] - light_pos[1];
+	d[2] = center[2] - light_pos[2];
+	dist = VEC_MAGNITUDE(d);
+	far_dist = light_radius + radius;
+	if(dist <= radius * 1.01f) {
+		far_center[0] = light_pos[0];
+		far_center[1] = light_pos[1];
+		far_center[2] = light_pos[2];
+		far_radius = far_dist;
+	} else {
+		far_center[0] = light_pos[0] + d[0] / dist * far_dist;
+		far_center[1] = light_pos[1] + d[1] / dist * far_dist;
+		far_center[2] = light_pos[2] + d[2] / dist * far_dist;
+		far_radius = far_dist * radius / sqrtf(dist * dist - radius * radius);
+	}
+
+	for(i = 0; i < 3; i++) {
+		mins[i] = center[i] - radius;
+		maxs[i] = center[i] + radius;
+		if(far_center[i] - far_radius < mins[i])
+			mins[i] = far_center[i] - far_radius;
+		if(far_center[i] + far_radius > maxs[i])
+			maxs[i] = far_center[i] + far_radius;
+
+		if(mins[i] < scene_mins[i])
+			mins[i] = scene_mins[i];
+		if(maxs[i] > scene_maxs[i])
+			maxs[i] = scene_maxs[i];
+	}
+}
+
+static void
+render_box(float mins[3], float maxs[3])
+{
+	glBegin(GL_QUADS);
+		glVertex3f(mins[0], mins[1], mins[2]);
+		glVertex3f(maxs[0], mins[1], mins[2]);
+		glVertex3f(maxs[0], maxs[1], mins[2]);
+		glVertex3f(mins[0], maxs[1], mins[2]);
+
+		glVertex3f(mins[0], mins[1], maxs[2]);
+		glVertex3f(mins[0], maxs[1], maxs[2]);
+		glVertex3f(maxs[0], maxs[1], maxs[2]);
+		glVertex3f(maxs[0], mins[1], maxs[2]);
+
+		glVertex3f(mins[0], mins[1], mins[2]);
+		glVertex3f(mins[0], maxs[1], mins[2]);
+		glVertex3f(mins[0], maxs[1], maxs[2]);
+		glVertex3f(mins[0], mins[1], maxs[2]);
+
+		glVertex3f(maxs[0], mins[1], mins[2]);
+		glVertex3f(maxs[0], mins[1], maxs[2]);
+		glVertex3f(maxs[0], maxs[1], maxs[2]);
+		glVertex3f(maxs[0], maxs[1], mins[2]);
+
+		glVertex3f(mins[0], mins[1], mins[2]);
+		glVertex3f(mins[0], mins[1], maxs[2]);
+		glVertex3f(maxs[0], mins[1], maxs[2]);
+		glVertex3f(maxs[0], mins[1], mins[2]);
+
+		glVertex3f(mins[0], maxs[1], mins[2]);
+		glVertex3f(maxs[0], maxs[1], mins[2]);
+		glVertex3f(maxs[0], maxs[1], maxs[2]);
+		glVertex3f(mins[0], maxs[1], maxs[2]);
+	glEnd();
+}
+
+/* pick up the results of last frame's queries that are in, without waiting for the rest */
+static void
+collect_occlusion()
+{
+	unsigned int i, q;
+	GLuint available, samples;
+
+	for(i = 0; i < num_instances; i++) {
+		for(q = 0; q < 4; q++) {
+			if(!shadows[i].queried[q])
+				continue;
+
+			glGetQueryObjectuiv(shadows[i].queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available)
+				continue;
+
+			glGetQueryObjectuiv(shadows[i].queries[q], GL_QUERY_RESULT, &samples);
+			shadows[i].occluded[q] = (samples == 0);
+			shadows[i].queried[q] = 0;
+		}
+	}
+}
+
+/*
+ * query the boxes of the instances in the frustum against what's been
+ * drawn, and the boxes of the shadows of the rest; a box the camera is
+ * inside of can't be tested, so it always counts as visible
+ */
+static void
+query_occlusion(float mv[16])
+{
+	struct md2_instance *ip;
+	float eye[3], light_pos[3], mins[3], maxs[3];
+	unsigned int i;
+	int j, k;
+
+	if(!queries_supported())
+		return;
+
+	for(k = 0; k < 3; k++)
+		eye[k] = -(mv[k * 4] * mv[12] + mv[k * 4 + 1] * mv[13] + mv[k * 4 + 2] * mv[14]);
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDepthFunc(GL_LEQUAL);
+
+	for(i = 0; i < num_instances; i++) {
+		ip = instances + i;
+		for(j = 0; j < 4; j++) {
+			if(shadows[i].queried[j])
+				continue;
+
+			if(j == 0) {
+				if(!shadows[i].in_frustum)
+					continue;
+				for(k = 0; k < 3; k++) {
+					mins[k] = ip->center[k] - ip->radius;
+					maxs[k] = ip->center[k] + ip->radius;
+				}
+			} else {
+				/* a visible instance's shadow is right next to it */
+				if(ip->visible) {
+					shadows[i].occluded[j] = 0;
+					continue;
+				}
+				get_light_position(lights[j - 1], light_pos);
+				get_shadow_box(light_pos, get_light_radius(lights[j - 1]), ip->center, ip->radius, mins, maxs);
+			}
+
+			for(k = 0; k < 3; k++) {
+				if(eye[k] < mins[k] - 0.1f || eye[k] > maxs[k] + 0.1f)
+					break;
+			}
+			if(k == 3) {
+				shadows[i].occluded[j] = 0;
+				continue;
+			}
+
+			glBeginQuery(GL_SAMPLES_PASSED, shadows[i].queries[j]);
+			render_box(mins, maxs);
+			glEndQuery(GL_SAMPLES_PASSED);
+			shadows[i].queried[j] = 1;
+		}
+	}
+
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+/* render the volumes of the instances casting a shadow from the light */
+static void
+render_shadow_volumes(int light_num, float light_pos[3], int caps)
+{
+	struct md2_instance *ip;
+	unsigned int i;
+
+	for(i = 0; i < num_instances; i++) {
+		if(!shadows[i].casts[light_num] || shadows[i].caps[light_num] != caps)
+			continue;
+
+		ip = instances + i;
+		if(gpu_shadows && shadow_shader)
+			md2_render_shadow_volume_gpu(shadows[i].lod, &(ip->player->pose), ip->pos, ip->rot, light_pos, caps);
+		else
+			md2_render_shadow_volume(shadows[i].sp[light_num], caps);
+	}
+}
+
 static void
 set_surfaces_vectors()
 {
@@ -175,7 +893,7 @@ set_surfaces_vectors()
 static void
 create_surfaces()
 {
-	int i;
+	int i, j;
 	float tmp[3];
 
 	num_surfaces = 6;
@@ -183,8 +901,7 @@ create_surfaces()
 
 	/* floor */
 	surfaces[0].occluder = 0;
-	surfaces[0].tex_num = 1;
-	load_texture(surfaces[0].tex_num, "data/floor.pcx");
+	surfaces[0].texture = textures[TEXTURE_FLOOR];
 
 	surfaces[0].texcoords[0][0] = 0.0f; surfaces[0].texcoords[0][1] = 0.0f;
 	surfaces[0].vertices[0][0] = -20.0f;
@@ -208,8 +925,7 @@ create_surfaces()
 
 	/* ceiling */
 	surfaces[1].occluder = 0;
-	surfaces[1].tex_num = 2;
-	load_texture(surfaces[1].tex_num, "data/ceiling.pcx");
+	surfaces[1].texture = textures[TEXTURE_CEILING];
 
 	surfaces[1].texcoords[0][0] = 0.0f; surfaces[1].texcoords[0][1] = 0.0f;
 	surfaces[1].vertices[0][0] = -20.0f;
@@ -233,8 +949,7 @@ create_surfaces()
 
 	/* front wall */
 	surfaces[2].occluder = 0;
-	surfaces[2].tex_num = 3;
-	load_texture(surfaces[2].tex_num, "data/wall.pcx");
+	surfaces[2].texture = textures[TEXTURE_WALL];
 
 	surfaces[2].texcoords[0][0] = 0.0f; surfaces[2].texcoords[0][1] = 0.0f;
 	surfaces[2].vertices[0][0] = -20.0f;
@@ -258,7 +973,7 @@ create_surfaces()
 
 	/* back wall */
 	surfaces[3].occluder = 0;
-	surfaces[3].tex_num = 3;
+	surfaces[3].texture = textures[TEXTURE_WALL];
 
 	surfaces[3].texcoords[0][0] = 0.0f; surfaces[3].texcoords[0][1] = 0.0f;
 	surfaces[3].vertices[0][0] = -20.0f;
@@ -282,7 +997,7 @@ create_surfaces()
 
 	/* left wall */
 	surfaces[4].occluder = 0;
-	surfaces[4].tex_num = 3;
+	surfaces[4].texture = textures[TEXTURE_WALL];
 
 	surfaces[4].texcoords[0][0] = 0.0f; surfaces[4].texcoords[0][1] = 0.0f;
 	surfaces[4].vertices[0][0] = -20.0f;
@@ -306,7 +1021,7 @@ create_surfaces()
 
 	/* right wall */
 	surfaces[5].occluder = 0;
-	surfaces[5].tex_num = 3;
+	surfaces[5].texture = textures[TEXTURE_WALL];
 
 	surfaces[5].texcoords[0][0] = 0.0f; surfaces[5].texcoords[0][1] = 0.0f;
 	surfaces[5].vertices[0][0] = 20.0f;
@@ -331,6 +1046,32 @@ create_surfaces()
 	/***********************/
 	set_surfaces_vectors();
 
+	for(i = 0; i < 3; i++) {
+		scene_mins[i] = scene_maxs[i] = surfaces[0].vertices[0][i];
+		for(j = 0; j < num_surfaces * 4; j++) {
+			tmp[0] = surfaces[j / 4].vertices[j % 4][i];
+			if(tmp[0] < scene_mins[i])
+				scene_mins[i] = tmp[0];
+			if(tmp[0] > scene_maxs[i])
+				scene_maxs[i] = tmp[0];
+		}
+	}
+	md2_set_shadow_bounds(scene_mins, scene_maxs);
+
+	shadow_shader = md2_init_shadow_shader();
+
+	/* shadow maps can only be switched to if every light gets one */
+	if(shadowmap_init()) {
+		for(i = 0; i < 3; i++)
+			maps[i] = shadowmap_create(SHADOW_MAP_SIZE);
+		if(!maps[0] || !maps[1] || !maps[2]) {
+			for(i = 0; i < 3; i++) {
+				shadowmap_free(maps[i]);
+				maps[i] = NULL;
+			}
+		}
+	}
+
 	lights[0] = create_light();
 	set_light_color(lights[0], 1.0f, 1.0f, 1.0f);
 
@@ -355,12 +1096,20 @@ create_surfaces()
 void
 draw_scene()
 {
-	static float model_pos[3] = { 0.0f, -0.8f, 2.0f };
-	static float model_rot[3] = { -90.0f, -90.0f, 0.0f };
-	static unsigned int model_frame = 0;
+	static int last_time = -1;
+	struct md2_instance *ip;
+	int time;
 	int i, j;
 	int tex;
-	float tmp[3];
+	unsigned int num_jobs;
+	float tmp[3], d[3];
+	float light_radius, dist;
+	float mv[16], proj[16], mvp[16];
+	float planes[6][4];
+	int rects[3][4], bounds[4];
+	int lit[3], num_lit;
+	int use_maps;
+	struct caps_pyramid pyramid;
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glLoadIdentity();
@@ -378,11 +1127,8 @@ draw_scene()
 	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
 
 	for(i = 0; i < num_surfaces; i++) {
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, surfaces[i].tex_num);
-
 		glActiveTextureARB(GL_TEXTURE1_ARB);
+		tex = -1;
 		if(light) {
 			tex = gen_lightmap_texture(surfaces[i].vertices[0], surfaces[i].d_x, surfaces[i].d_y, surfaces[i].down_vector, surfaces[i].right_vector, 64);
 			if(tex != -1) {
@@ -398,6 +1144,11 @@ draw_scene()
 			glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
 		}
 
+		/* after the lightmap, so an indexed texture knows whether there is one */
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glEnable(GL_TEXTURE_2D);
+		textures_bind(surfaces[i].texture, (tex != -1));
+
 		glBegin(GL_QUADS);
 			glMultiTexCoord2fvARB(GL_TEXTURE0_ARB, surfaces[i].texcoords[0]);
 			glMultiTexCoord2fARB(GL_TEXTURE1_ARB, 0.0f, 0.0f);
@@ -413,6 +1164,7 @@ draw_scene()
 			glVertex3fv(surfaces[i].vertices[3]);
 		glEnd();
 	}
+	textures_bind(NULL, FALSE);
 
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	glDisable(GL_TEXTURE_2D);
@@ -421,23 +1173,105 @@ draw_scene()
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	render_lights();
 
-	/* render textured md2 model */
-	if(m) {
-		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-		glPushMatrix();
-		glTranslatef(model_pos[0], model_pos[1], model_pos[2]);
-		glRotatef(model_rot[2], 0.0f, 0.0f, -1.0f);
-		glRotatef(model_rot[1], 0.0f, 1.0f, 0.0f);
-		glRotatef(model_rot[0], 1.0f, 0.0f, 0.0f);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 4);
-		md2_render(m, model_frame);
-		glDisable(GL_TEXTURE_2D);
-		glPopMatrix();
+	/* animate by the time that has passed, whatever the frame rate */
+	time = glutGet(GLUT_ELAPSED_TIME);
+	if(last_time == -1)
+		last_time = time;
+	md2_update_instances(instances, num_instances, (float)(time - last_time) / 1000.0f);
+	last_time = time;
+	update_casters_version();
+
+	/* render the textured md2 model's instances that are in view */
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	glGetFloatv(GL_PROJECTION_MATRIX, proj);
+	multiply_matrix(mvp, mv, proj);
+	extract_frustum_planes(planes, mvp);
+
+	/* instances hidden behind something last frame aren't drawn or lit */
+	collect_occlusion();
+	for(i = 0; i < num_instances; i++) {
+		ip = instances + i;
+		shadows[i].in_frustum = sphere_in_frustum(planes, ip->center, ip->radius);
+		ip->visible = shadows[i].in_frustum && !shadows[i].occluded[0];
+		ip->player->pose.colors = NULL;
 	}
+	if(light)
+		threads_parallel_for(light_instance, NULL, num_instances);
+
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	glEnable(GL_TEXTURE_2D);
+	textures_bind(textures[TEXTURE_SKIN], FALSE);
+	for(i = 0; i < num_instances; i++) {
+		ip = instances + i;
+		if(!ip->visible)
+			continue;
+
+		render_instance(ip);
+	}
+	textures_bind(NULL, FALSE);
+	glDisable(GL_TEXTURE_2D);
+
+	query_occlusion(mv);
+
+	use_maps = (shadow_maps && maps[0]);
+	if(use_maps && light && m)
+		render_shadow_maps();
 
 #ifdef USE_STENCIL
-	if(light && m) {
+	num_lit = 0;
+	for(j = 0; !use_maps && light && m && j < 3; j++) {
+		/*
+		 * skip lights that don't light any part of the scene that's on
+		 * the screen, or that have no instance close enough to cast a
+		 * shadow that could be seen
+		 */
+		get_light_position(lights[j], tmp);
+		light_radius = get_light_radius(lights[j]);
+		lit[j] = 0;
+		if(!get_light_scissor(tmp, light_radius, rects[j]))
+			continue;
+
+		for(i = 0; i < num_instances; i++) {
+			ip = instances + i;
+			d[0] = tmp[0] - ip->center[0];
+			d[1] = tmp[1] - ip->center[1];
+			d[2] = tmp[2] - ip->center[2];
+
+			shadows[i].casts[j] = 0;
+			if(VEC_MAGNITUDE(d) > light_radius + ip->radius)
+				continue;
+			if(!shadow_in_frustum(planes, tmp, light_radius, ip->center, ip->radius))
+				continue;
+			if(!ip->visible && shadows[i].occluded[j + 1])
+				continue;
+
+			shadows[i].casts[j] = 1;
+			lit[j] = 1;
+		}
+		if(!lit[j])
+			continue;
+
+		if(num_lit++ == 0) {
+			bounds[0] = rects[j][0];
+			bounds[1] = rects[j][1];
+			bounds[2] = rects[j][2];
+			bounds[3] = rects[j][3];
+		} else {
+			if(rects[j][0] < bounds[0])
+				bounds[0] = rects[j][0];
+			if(rects[j][1] < bounds[1])
+				bounds[1] = rects[j][1];
+			if(rects[j][2] > bounds[2])
+				bounds[2] = rects[j][2];
+			if(rects[j][3] > bounds[3])
+				bounds[3] = rects[j][3];
+		}
+	}
+
+	if(num_lit) {
+		/* only touch the parts of the screen that can be shadowed */
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(bounds[0], bounds[1], bounds[2] - bounds[0], bounds[3] - bounds[1]);
 		glClear(GL_STENCIL_BUFFER_BIT);
 
 		glColor4f(0.0f, 0.0f, 0.0f, 1.0f);
@@ -446,36 +1280,110 @@ draw_scene()
 
 		glEnable(GL_CULL_FACE);
 		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, 0x0, 0xff);
+
+		/*
+		 * an instance's shadows only need to be as detailed as the
+		 * closest of the camera and the lights that it casts them from
+		 */
+		for(i = 0; i < num_instances; i++) {
+			ip = instances + i;
+			d[0] = mv[0] * ip->center[0] + mv[4] * ip->center[1] + mv[8] * ip->center[2] + mv[12];
+			d[1] = mv[1] * ip->center[0] + mv[5] * ip->center[1] + mv[9] * ip->center[2] + mv[13];
+			d[2] = mv[2] * ip->center[0] + mv[6] * ip->center[1] + mv[10] * ip->center[2] + mv[14];
+			dist = VEC_MAGNITUDE(d);
+			for(j = 0; j < 3; j++) {
+				if(!lit[j] || !shadows[i].casts[j])
+					continue;
+
+				get_light_position(lights[j], tmp);
+				d[0] = tmp[0] - ip->center[0];
+				d[1] = tmp[1] - ip->center[1];
+				d[2] = tmp[2] - ip->center[2];
+				if(VEC_MAGNITUDE(d) < dist)
+					dist = VEC_MAGNITUDE(d);
+			}
+			shadows[i].lod = md2_get_shadow_lod(m, dist);
+		}
 
+		/*
+		 * pick how each volume is rendered here, since that needs the
+		 * matrices, then build all the volumes on the worker threads
+		 */
+		num_jobs = 0;
 		for(j = 0; j < 3; j++) {
+			if(!lit[j])
+				continue;
+
 			get_light_position(lights[j], tmp);
-			md2_calculate_visible_tris(m, model_frame, model_pos, model_rot, tmp);
+			setup_caps_pyramid(&pyramid, mv, proj, tmp);
+			for(i = 0; i < num_instances; i++) {
+				if(!shadows[i].casts[j])
+					continue;
+
+				ip = instances + i;
+				shadows[i].caps[j] = shadow_needs_caps(&pyramid, mv, ip->center, ip->radius);
+				if(!(gpu_shadows && shadow_shader)) {
+					jobs[num_jobs].instance = i;
+					jobs[num_jobs].light = j;
+					num_jobs++;
+				}
+			}
+		}
+		threads_parallel_for(build_shadow_job, jobs, num_jobs);
+
+		for(j = 0; j < 3; j++) {
+			if(!lit[j])
+				continue;
 
-			/* render back faces, incrementing stencil on zfail... */
+			get_light_position(lights[j], tmp);
+			glScissor(rects[j][0], rects[j][1], rects[j][2] - rects[j][0], rects[j][3] - rects[j][1]);
+
+			/*
+			 * render the volumes of every instance the light reaches
+			 * together; volumes that need caps use zfail, the rest
+			 * use zpass. render back faces,
+			 * incrementing stencil on zfail, and front faces,
+			 * decrementing on zfail...
+			 */
 			glCullFace(GL_FRONT);
-			glStencilFunc(GL_ALWAYS, 0x0, 0xff);
 			glStencilOp(GL_KEEP, GL_INCR, GL_KEEP); /* INCR */
-			md2_render_shadow_volume(m, model_frame, model_pos, model_rot, tmp);
-
-			/* ... and render front faces, decrementing on zfail. */
+			render_shadow_volumes(j, tmp, TRUE);
 			glCullFace(GL_BACK);
-			glStencilFunc(GL_ALWAYS, 0x0, 0xff);
 			glStencilOp(GL_KEEP, GL_DECR, GL_KEEP); /* DECR */
-			md2_render_shadow_volume(m, model_frame, model_pos, model_rot, tmp);
+			render_shadow_volumes(j, tmp, TRUE);
+
+			/*
+			 * ... then front faces, incrementing on zpass, and back
+			 * faces, decrementing on zpass.
+			 */
+			glCullFace(GL_BACK);
+			glStencilOp(GL_KEEP, GL_KEEP, GL_INCR); /* INCR */
+			render_shadow_volumes(j, tmp, FALSE);
+			glCullFace(GL_FRONT);
+			glStencilOp(GL_KEEP, GL_KEEP, GL_DECR); /* DECR */
+			render_shadow_volumes(j, tmp, FALSE);
 		}
 
 		glDisable(GL_STENCIL_TEST);
 		glDisable(GL_CULL_FACE);
 		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
+		glScissor(bounds[0], bounds[1], bounds[2] - bounds[0], bounds[3] - bounds[1]);
 		render_stencil_shadow();
 		glDepthMask(GL_TRUE);
+		glDisable(GL_SCISSOR_TEST);
 	}
 #endif /* USE_STENCIL */
 
 	glFlush();
 	glutSwapBuffers();
 
+	if(!first_frame_shown) {
+		printf("First frame shown after %d ms\n", glutGet(GLUT_ELAPSED_TIME));
+		first_frame_shown = 1;
+	}
+
 	for(i = 0; i < 3; i++) {
 		tmp[0] = cosf(DEG2RAD(light_rot[i])) * 15.0f;
 		tmp[1] = 0.33f;
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "shader.h"
+
+/*
+ * check whether the context supports OpenGL 2.0 shaders; the result is
+ * cached, so this must be called after the context has been created
+ */
+int
+shaders_supported()
+{
+	static int supported = -1;
+	const char *version;
+
+	if(supported != -1)
+		return supported;
+
+	version = (const char *)glGetString(GL_VERSION);
+	supported = (version && atoi(version) >= 2);
+
+	return supported;
+}
+
+/* check whether the context supports buffer objects, core since 1.5 */
+int
+buffers_supported()
+{
+	static int supported = -1;
+	const char *version;
+	int major, minor;
+
+	if(supported != -1)
+		return supported;
+
+	version = (const char *)glGetString(GL_VERSION);
+	if(!version || sscanf(version, "%d.%d", &major, &minor) != 2)
+		supported = 0;
+	else
+		supported = (major > 1 || minor >= 5);
+
+	return supported;
+}
+
+/* check whether the context supports occlusion queries, core since 1.5 like buffer objects */
+int
+queries_supported()
+{
+	return buffers_supported();
+}
+
+/* check whether the context supports framebuffer objects with depth cube maps, core since 3.0 */
+int
+framebuffers_supported()
+{
+	static int supported = -1;
+	const char *version;
+
+	if(supported != -1)
+		return supported;
+
+	version = (const char *)glGetString(GL_VERSION);
+	supported = (version && atoi(version) >= 3);
+
+	return supported;
+}
+
+static GLuint
+compile_shader(GLenum type, const char *src)
+{
+	GLuint shader;
+	GLint status;
+	char log[1024];
+
+	shader = glCreateShader(type);
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if(!status) {
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "Error: Couldn't compile shader:\n%s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+/*
+ * create a program from the given shader sources, either of which may be
+ * NULL to use the fixed function pipeline for that stage; attribs is a
+ * NULL-terminated list of attribute names, bound to locations 1 and up
+ * (location 0 is left to gl_Vertex). returns 0 on failure
+ */
+unsigned int
+create_shader_program(const char *vertex_src, const char *fragment_src,
+                      const char *attribs[])
+{
+	GLuint program;
+	GLuint vertex = 0, fragment = 0;
+	GLint status;
+	char log[1024];
+	int i;
+
+	if(!shaders_supported())
+		return 0;
+
+	if(vertex_src) {
+		vertex = compile_shader(GL_VERTEX_SHADER, vertex_src);
+		if(!vertex)
+			return 0;
+	}
+	if(fragment_src) {
+		fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_src);
+		if(!fragment) {
+			if(vertex)
+				glDeleteShader(vertex);
+			return 0;
+		}
+	}
+
+	program = glCreateProgram();
+	if(vertex)
+		glAttachShader(program, vertex);
+	if(fragment)
+		glAttachShader(program, fragment);
+	for(i = 0; attribs && attribs[i]; i++)
+		glBindAttribLocation(program, i + 1, attribs[i]);
+	glLinkProgram(program);
+
+	/* the program keeps the shaders around for as long as it needs them */
+	if(vertex)
+		glDeleteShader(vertex);
+	if(fragment)
+		glDeleteShader(fragment);
+
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if(!status) {
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "Error: Couldn't link shader program:\n%s\n", log);
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+void
+destroy_shader_program(unsigned int program)
+{
+	if(program)
+		glDeleteProgram(program);
+}
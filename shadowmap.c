@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * shadows from cube maps of the distance from each light to whatever casts
+ * shadows around it. a map costs six depth-only passes over the casters
+ * in the light's radius, whatever their silhouettes look like, and is only
+ * rendered again when the light or the casters change
+ */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glu.h>
+#include "my_math.h"
+#include "shader.h"
+#include "shadowmap.h"
+
+#define MAX_RECEIVER_MAPS 3
+
+/* how much closer than the map a receiver has to be to be lit, over the light's radius */
+#define SHADOW_MAP_BIAS 0.0005f
+
+/* the casters write their distance from the light, so every face compares the same way */
+static const char *caster_vertex_src =
+	"varying vec3 v;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	v = (gl_ModelViewMatrix * gl_Vertex).xyz;\n"
+	"	gl_Position = gl_ProjectionMatrix * vec4(v, 1.0);\n"
+	"}\n";
+
+static const char *caster_fragment_src =
+	"uniform float radius;\n"
+	"varying vec3 v;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragDepth = length(v) / radius;\n"
+	"}\n";
+
+/*
+ * receivers are drawn in world space a second time, darkening what's
+ * further from a light than its map says, like the stencil shadows do
+ */
+static const char *receiver_vertex_src =
+	"varying vec3 pos;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	pos = gl_Vertex.xyz;\n"
+	"	gl_Position = ftransform();\n"
+	"}\n";
+
+static const char *receiver_fragment_src =
+	"uniform samplerCube map0, map1, map2;\n"
+	"uniform vec3 lights[3];\n"
+	"uniform float radii[3];\n"
+	"varying vec3 pos;\n"
+	"\n"
+	"bool shadowed(samplerCube map, vec3 light, float radius)\n"
+	"{\n"
+	"	vec3 d = pos - light;\n"
+	"	float dist;\n"
+	"\n"
+	"	if(radius <= 0.0)\n"
+	"		return false;\n"
+	"	dist = length(d) / radius;\n"
+	"	return (dist < 1.0 && dist - BIAS > textureCube(map, d).r);\n"
+	"}\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	if(!shadowed(map0, lights[0], radii[0]) &&\n"
+	"	   !shadowed(map1, lights[1], radii[1]) &&\n"
+	"	   !shadowed(map2, lights[2], radii[2]))\n"
+	"		discard;\n"
+	"\n"
+	"	gl_FragColor = vec4(0.0, 0.0, 0.0, 0.5);\n"
+	"}\n";
+
+/* the direction and up vector of each face of a cube map, in GL's order */
+static const float faces[6][2][3] = {
+	{ {  1.0f,  0.0f,  0.0f }, { 0.0f, -1.0f,  0.0f } },
+	{ { -1.0f,  0.0f,  0.0f }, { 0.0f, -1.0f,  0.0f } },
+	{ {  0.0f,  1.0f,  0.0f }, { 0.0f,  0.0f,  1.0f } },
+	{ {  0.0f, -1.0f,  0.0f }, { 0.0f,  0.0f, -1.0f } },
+	{ {  0.0f,  0.0f,  1.0f }, { 0.0f, -1.0f,  0.0f } },
+	{ {  0.0f,  0.0f, -1.0f }, { 0.0f, -1.0f,  0.0f } }
+};
+
+static GLuint framebuffer = 0;
+static GLuint caster_program = 0;
+static GLint caster_radius_uniform = -1;
+static GLuint receiver_program = 0;
+static GLint receiver_lights_uniform = -1;
+static GLint receiver_radii_uniform = -1;
+
+/* set up what all the maps share; FALSE if shadow maps can't be used */
+int
+shadowmap_init()
+{
+	char src[2048];
+
+	if(!framebuffers_supported() || !shaders_supported())
+		return FALSE;
+	if(framebuffer)
+		return TRUE;
+
+	caster_program = create_shader_program(caster_vertex_src, caster_fragment_src, NULL);
+	snprintf(src, sizeof(src), "#define BIAS %f\n%s", SHADOW_MAP_BIAS, receiver_fragment_src);
+	receiver_program = create_shader_program(receiver_vertex_src, src, NULL);
+	if(!caster_program || !receiver_program) {
+		shadowmap_shutdown();
+		return FALSE;
+	}
+	caster_radius_uniform = glGetUniformLocation(caster_program, "radius");
+	receiver_lights_uniform = glGetUniformLocation(receiver_program, "lights");
+	receiver_radii_uniform = glGetUniformLocation(receiver_program, "radii");
+
+	glUseProgram(receiver_program);
+	glUniform1i(glGetUniformLocation(receiver_program, "map0"), 0);
+	glUniform1i(glGetUniformLocation(receiver_program, "map1"), 1);
+	glUniform1i(glGetUniformLocation(receiver_program, "map2"), 2);
+	glUseProgram(0);
+
+	glGenFramebuffers(1, &framebuffer);
+	return TRUE;
+}
+
+void
+shadowmap_shutdown()
+{
+	destroy_shader_program(caster_program);
+	destroy_shader_program(receiver_program);
+	caster_program = receiver_program = 0;
+	if(framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	framebuffer = 0;
+}
+
+struct shadow_map *
+shadowmap_create(unsigned int size)
+{
+	struct shadow_map *sm;
+	GLenum status;
+	int i;
+
+	if(!framebuffer)
+		return NULL;
+
+	sm = malloc(sizeof(struct shadow_map));
+	if(!sm) {
+		fprintf(stderr, "Error: Couldn't allocate memory for shadow map\n");
+		return NULL;
+	}
+	sm->size = size;
+	sm->valid = 0;
+
+	glGenTextures(1, &(sm->texture));
+	glBindTexture(GL_TEXTURE_CUBE_MAP, sm->texture);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	for(i = 0; i < 6; i++)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	/* make sure the driver can render to it */
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, sm->texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Error: Can't render to a depth cube map (status 0x%x)\n", status);
+		shadowmap_free(sm);
+		return NULL;
+	}
+
+	return sm;
+}
+
+void
+shadowmap_free(struct shadow_map *sm)
+{
+	if(!sm)
+		return;
+
+	glDeleteTextures(1, &(sm->texture));
+	free(sm);
+}
+
+/*
+ * check whether the map has to be rendered again for the light and the
+ * given version of the casters, and remember them if it does
+ */
+int
+shadowmap_needs_update(struct shadow_map *sm, float light_pos[3],
+                       float light_radius, unsigned int casters)
+{
+	if(sm->valid && sm->casters == casters && sm->light_radius == light_radius &&
+	   sm->light_pos[0] == light_pos[0] && sm->light_pos[1] == light_pos[1] &&
+	   sm->light_pos[2] == light_pos[2])
+		return FALSE;
+
+	sm->light_pos[0] = light_pos[0];
+	sm->light_pos[1] = light_pos[1];
+	sm->light_pos[2] = light_pos[2];
+	sm->light_radius = light_radius;
+	sm->casters = casters;
+	sm->valid = 1;
+
+	return TRUE;
+}
+
+/*
+ * start rendering the map; each face is chosen with shadowmap_set_face()
+ * and then the casters are drawn as usual, through the modelview matrix
+ */
+void
+shadowmap_begin(struct shadow_map *sm)
+{
+	glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	gluPerspective(90.0f, 1.0f, 0.05f, sm->light_radius);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, sm->size, sm->size);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glClearDepth(1.0f);
+
+	glUseProgram(caster_program);
+	glUniform1f(caster_radius_uniform, sm->light_radius);
+}
+
+void
+shadowmap_set_face(struct shadow_map *sm, int face)
+{
+	const float *dir = faces[face][0], *up = faces[face][1];
+	float *p = sm->light_pos;
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, sm->texture, 0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glLoadIdentity();
+	gluLookAt(p[0], p[1], p[2], p[0] + dir[0], p[1] + dir[1], p[2] + dir[2], up[0], up[1], up[2]);
+}
+
+void
+shadowmap_end()
+{
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+}
+
+/*
+ * get ready to draw the surfaces that receive shadows from up to three
+ * maps, in world coordinates; what they're drawn with is left alone
+ * where they're lit, and darkened where any of the maps shadows them
+ */
+void
+shadowmap_begin_receivers(struct shadow_map *maps[], int num)
+{
+	float lights[MAX_RECEIVER_MAPS][3], radii[MAX_RECEIVER_MAPS];
+	int i;
+
+	for(i = 0; i < MAX_RECEIVER_MAPS; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		if(i < num && maps[i]) {
+			glBindTexture(GL_TEXTURE_CUBE_MAP, maps[i]->texture);
+			lights[i][0] = maps[i]->light_pos[0];
+			lights[i][1] = maps[i]->light_pos[1];
+			lights[i][2] = maps[i]->light_pos[2];
+			radii[i] = maps[i]->light_radius;
+		} else {
+			glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+			lights[i][0] = lights[i][1] = lights[i][2] = 0.0f;
+			radii[i] = 0.0f;
+		}
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	glUseProgram(receiver_program);
+	glUniform3fv(receiver_lights_uniform, MAX_RECEIVER_MAPS, lights[0]);
+	glUniform1fv(receiver_radii_uniform, MAX_RECEIVER_MAPS, radii);
+
+	glDepthFunc(GL_LEQUAL);
+	glDepthMask(GL_FALSE);
+}
+
+void
+shadowmap_end_receivers()
+{
+	int i;
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+	glUseProgram(0);
+
+	for(i = 0; i < MAX_RECEIVER_MAPS; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
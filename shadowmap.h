@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+
+#define SHADOW_MAP_SIZE 256
+
+/* the distances from a light to the closest casters around it */
+struct shadow_map {
+	unsigned int texture; /* a depth cube map, over the light's radius */
+	unsigned int size;
+
+	/* what it was last rendered for */
+	int valid;
+	float light_pos[3];
+	float light_radius;
+	unsigned int casters; /* the version of the casters */
+};
+
+int shadowmap_init();
+void shadowmap_shutdown();
+struct shadow_map *shadowmap_create(unsigned int size);
+void shadowmap_free(struct shadow_map *sm);
+int shadowmap_needs_update(struct shadow_map *sm, float light_pos[3], float light_radius, unsigned int casters);
+void shadowmap_begin(struct shadow_map *sm);
+void shadowmap_set_face(struct shadow_map *sm, int face);
+void shadowmap_end();
+void shadowmap_begin_receivers(struct shadow_map *maps[], int num);
+void shadowmap_end_receivers();
+
+#endif /* __SHADOWMAP_H__ */
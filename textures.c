@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * textures shared by everything that uses the same file, or a file with
+ * the same pixels. each is uploaded once, counts its users, and is kept
+ * around after the last of them is done with it until the budget's needed
+ * for something else, so loading it again is free. indexed textures stay
+ * as a byte a texel, and are looked up in their palettes by a shader
+ */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "my_math.h"
+#include "md2cache.h"
+#include "mipmap.h"
+#include "shader.h"
+#include "textures.h"
+
+/* the texture unit palettes are bound to, after the texture and a lightmap */
+#define PALETTE_UNIT 2
+
+/* a file a texture was loaded from; a texture can be known by many */
+struct texture_name {
+	char *filename; /* allocated right after it */
+	struct texture *tp;
+	struct texture_name *next;
+};
+
+static struct texture *textures = NULL;
+static struct texture_name *names = NULL;
+
+static struct texture *lru_first = NULL; /* least recently used */
+static struct texture *lru_last = NULL;
+static size_t textures_size = 0;
+static size_t textures_budget = TEXTURE_CACHE_BUDGET;
+
+/*
+ * looks an indexed texture's colors up in its palette, then does what the
+ * fixed function pipeline would with the color and a lightmap. indices are
+ * point sampled, since there's nothing between two of them to filter to
+ */
+static const char *palette_vertex_src =
+	"void main()\n"
+	"{\n"
+	"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+	"	gl_TexCoord[1] = gl_MultiTexCoord1;\n"
+	"	gl_FrontColor = gl_Color;\n"
+	"	gl_Position = ftransform();\n"
+	"}\n";
+
+static const char *palette_fragment_src =
+	"uniform sampler2D indices;\n"
+	"uniform sampler2D lightmap;\n"
+	"uniform sampler2D palette;\n"
+	"uniform bool lightmapped;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	float index = texture2D(indices, gl_TexCoord[0].st).r;\n"
+	"	vec4 color = texture2D(palette, vec2((index * 255.0 + 0.5) / 256.0, 0.5)) * gl_Color;\n"
+	"\n"
+	"	if(lightmapped)\n"
+	"		color *= texture2D(lightmap, gl_TexCoord[1].st);\n"
+	"	gl_FragColor = color;\n"
+	"}\n";
+
+static GLuint palette_program = 0;
+static GLint lightmapped_uniform = -1;
+static int palette_program_tried = FALSE;
+static int palette_program_used = FALSE;
+
+/*
+ * a hash of a texture's pixels, and of its palette if it's indexed, to
+ * tell textures apart by; their sizes are compared too
+ */
+uint64_t
+textures_hash(const unsigned char *pixels, const unsigned char *palette, unsigned int width, unsigned int height)
+{
+	if(!palette)
+		return md2_cache_hash(pixels, (size_t)width * height * 4);
+
+	return (md2_cache_hash(pixels, (size_t)width * height) * 0x100000001b3ULL) ^
+	       md2_cache_hash(palette, 256 * 4);
+}
+
+static void
+lru_unlink(struct texture *tp)
+{
+	if(tp->lru_prev)
+		tp->lru_prev->lru_next = tp->lru_next;
+	else if(lru_first == tp)
+		lru_first = tp->lru_next;
+	if(tp->lru_next)
+		tp->lru_next->lru_prev = tp->lru_prev;
+	else if(lru_last == tp)
+		lru_last = tp->lru_prev;
+	tp->lru_prev = tp->lru_next = NULL;
+}
+
+static void
+lru_append(struct texture *tp)
+{
+	tp->lru_prev = lru_last;
+	tp->lru_next = NULL;
+	if(lru_last)
+		lru_last->lru_next = tp;
+	else
+		lru_first = tp;
+	lru_last = tp;
+}
+
+/* delete a texture nothing uses, along with its names */
+static void
+free_texture(struct texture *tp)
+{
+	struct texture **tpp;
+	struct texture_name **npp, *np;
+
+	for(npp = &names; *npp; ) {
+		np = *npp;
+		if(np->tp == tp) {
+			*npp = np->next;
+			free(np);
+		} else {
+			npp = &(np->next);
+		}
+	}
+
+	for(tpp = &textures; *tpp != tp; tpp = &((*tpp)->next))
+		;
+	*tpp = tp->next;
+
+	lru_unlink(tp);
+	textures_size -= tp->size;
+	glDeleteTextures(1, &(tp->gl_num));
+	if(tp->palette_gl_num)
+		glDeleteTextures(1, &(tp->palette_gl_num));
+	free(tp);
+}
+
+/* delete unused textures, least recently used first, until there's room for size more bytes */
+static void
+trim_textures(size_t size)
+{
+	while(lru_first && textures_size + size > textures_budget)
+		free_texture(lru_first);
+}
+
+static int
+add_name(struct texture *tp, const char *filename)
+{
+	struct texture_name *np;
+
+	np = malloc(sizeof(struct texture_name) + strlen(filename) + 1);
+	if(!np) {
+		fprintf(stderr, "Error: Couldn't allocate memory for texture name\n");
+		return FALSE;
+	}
+	np->filename = (char *)(np + 1);
+	strcpy(np->filename, filename);
+	np->tp = tp;
+	np->next = names;
+	names = np;
+
+	return TRUE;
+}
+
+static void
+add_ref(struct texture *tp)
+{
+	if(tp->refs++ == 0)
+		lru_unlink(tp);
+}
+
+static struct texture *
+find_name(const char *filename)
+{
+	struct texture_name *np;
+
+	for(np = names; np; np = np->next) {
+		if(strcmp(np->filename, filename) == 0)
+			return np->tp;
+	}
+
+	return NULL;
+}
+
+/* the texture already loaded from filename, with another reference, or NULL if there isn't one */
+struct texture *
+textures_get(const char *filename)
+{
+	struct texture *tp;
+
+	tp = find_name(filename);
+	if(tp)
+		add_ref(tp);
+
+	return tp;
+}
+
+/* set up the shader indexed textures are drawn with; FALSE if they can't be */
+static int
+init_palette_program()
+{
+	if(palette_program_tried)
+		return (palette_program != 0);
+	palette_program_tried = TRUE;
+
+	if(!shaders_supported())
+		return FALSE;
+	palette_program = create_shader_program(palette_vertex_src, palette_fragment_src, NULL);
+	if(!palette_program)
+		return FALSE;
+	lightmapped_uniform = glGetUniformLocation(palette_program, "lightmapped");
+
+	glUseProgram(palette_program);
+	glUniform1i(glGetUniformLocation(palette_program, "indices"), 0);
+	glUniform1i(glGetUniformLocation(palette_program, "lightmap"), 1);
+	glUniform1i(glGetUniformLocation(palette_program, "palette"), PALETTE_UNIT);
+	glUseProgram(0);
+
+	return TRUE;
+}
+
+/* look indices up in a palette, for drawing an indexed texture without the shader */
+static unsigned char *
+expand_indices(const unsigned char *indices, const unsigned char *palette, size_t num)
+{
+	unsigned char *pixels;
+	size_t i;
+
+	pixels = malloc(num * 4);
+	if(!pixels) {
+		fprintf(stderr, "Error: Couldn't allocate memory for texture\n");
+		return NULL;
+	}
+	for(i = 0; i < num; i++)
+		memcpy(pixels + i * 4, palette + indices[i] * 4, 4);
+
+	return pixels;
+}
+
+/* upload a texture and its mipmaps to the bound texture */
+static void
+upload_levels(unsigned int width, unsigned int height, GLint internal_format,
+              GLenum format, unsigned int components, const unsigned char *pixels)
+{
+	int level;
+
+	for(level = 0; ; level++) {
+		glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+		if(width == 1 && height == 1)
+			break;
+		pixels += (size_t)width * height * components;
+		if(width > 1)
+			width >>= 1;
+		if(height > 1)
+			height >>= 1;
+	}
+}
+
+/*
+ * upload a file's decoded pixels followed by their mipmaps, and return
+ * the texture with a reference. the pixels are rgba, as made by
+ * mipmap_generate, unless there's a palette, in which case they're indices
+ * as made by mipmap_generate_indexed; without shaders those are expanded
+ * to rgba here. the hash is from textures_hash. if a texture with the same
+ * pixels is already loaded, that one's returned instead
+ */
+struct texture *
+textures_create(const char *filename, unsigned int width, unsigned int height, const unsigned char *pixels, const unsigned char *palette, uint64_t hash)
+{
+	struct texture *tp;
+	unsigned char *expanded = NULL;
+	int indexed;
+
+	indexed = (palette != NULL);
+	for(tp = textures; tp; tp = tp->next) {
+		if(tp->hash == hash && tp->width == width && tp->height == height && tp->indexed == indexed) {
+			if(find_name(filename) != tp && !add_name(tp, filename))
+				return NULL;
+			add_ref(tp);
+			return tp;
+		}
+	}
+
+	if(indexed && !init_palette_program()) {
+		expanded = expand_indices(pixels, palette, mipmap_size(width, height, 1));
+		if(!expanded)
+			return NULL;
+		pixels = expanded;
+		palette = NULL;
+	}
+
+	tp = malloc(sizeof(struct texture));
+	if(!tp) {
+		fprintf(stderr, "Error: Couldn't allocate memory for %s\n", filename);
+		free(expanded);
+		return NULL;
+	}
+	memset(tp, 0, sizeof(struct texture));
+	tp->width = width;
+	tp->height = height;
+	tp->hash = hash;
+	tp->indexed = indexed;
+	tp->refs = 1;
+
+	/* rgb textures are kept with 4 bytes a texel */
+	if(palette)
+		tp->size = mipmap_size(width, height, 1) + 256 * 4;
+	else
+		tp->size = mipmap_size(width, height, 4);
+
+	if(!add_name(tp, filename)) {
+		free(tp);
+		free(expanded);
+		return NULL;
+	}
+	tp->next = textures;
+	textures = tp;
+
+	trim_textures(tp->size);
+	textures_size += tp->size;
+
+	glGenTextures(1, &(tp->gl_num));
+	glBindTexture(GL_TEXTURE_2D, tp->gl_num);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	if(palette) {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		upload_levels(width, height, GL_LUMINANCE8, GL_LUMINANCE, 1, pixels);
+
+		glGenTextures(1, &(tp->palette_gl_num));
+		glBindTexture(GL_TEXTURE_2D, tp->palette_gl_num);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+	} else {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		upload_levels(width, height, 3, GL_RGBA, 4, pixels);
+	}
+
+	free(expanded);
+	return tp;
+}
+
+/* drop a reference; the last one leaves the texture to be deleted when its memory's needed */
+void
+textures_release(struct texture *tp)
+{
+	if(!tp || --tp->refs > 0)
+		return;
+
+	lru_append(tp);
+	trim_textures(0);
+}
+
+/*
+ * bind a texture on the first texture unit. an indexed texture is drawn
+ * with the palette shader, which modulates it by the color, and by the
+ * texture on the second unit if it's lightmapped, as the fixed function
+ * pipeline would; binding an rgb texture or NULL goes back to that
+ */
+void
+textures_bind(struct texture *tp, int lightmapped)
+{
+	if(tp && tp->palette_gl_num) {
+		glActiveTexture(GL_TEXTURE0 + PALETTE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, tp->palette_gl_num);
+		glActiveTexture(GL_TEXTURE0);
+		if(!palette_program_used) {
+			glUseProgram(palette_program);
+			palette_program_used = TRUE;
+		}
+		glUniform1i(lightmapped_uniform, lightmapped);
+	} else if(palette_program_used) {
+		glUseProgram(0);
+		palette_program_used = FALSE;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, tp ? tp->gl_num : 0);
+}
+
+/* the budget for all textures; ones in use can go over it */
+void
+textures_set_budget(size_t bytes)
+{
+	textures_budget = bytes;
+	trim_textures(0);
+}
+
+/* delete every texture, whether it's used or not */
+void
+textures_shutdown()
+{
+	while(textures)
+		free_texture(textures);
+
+	destroy_shader_program(palette_program);
+	palette_program = 0;
+	palette_program_tried = FALSE;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TEXTURES_H__
+#define __TEXTURES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* default size of the textures kept around once nothing uses them, and of all of them together */
+#define TEXTURE_CACHE_BUDGET (64 * 1024 * 1024)
+
+struct texture {
+	unsigned int gl_num;
+	unsigned int width, height;
+	size_t size; /* in video memory */
+	uint64_t hash; /* of the pixels */
+	int indexed; /* loaded as palette indices */
+	unsigned int palette_gl_num; /* if it's drawn through its palette */
+
+	int refs;
+
+	/* while nothing uses it, its place in the least recently used list */
+	struct texture *lru_prev;
+	struct texture *lru_next;
+
+	struct texture *next;
+};
+
+uint64_t textures_hash(const unsigned char *pixels, const unsigned char *palette, unsigned int width, unsigned int height);
+struct texture *textures_get(const char *filename);
+struct texture *textures_create(const char *filename, unsigned int width, unsigned int height, const unsigned char *pixels, const unsigned char *palette, uint64_t hash);
+void textures_release(struct texture *tp);
+void textures_bind(struct texture *tp, int lightmapped);
+void textures_set_budget(size_t bytes);
+void textures_shutdown();
+
+#endif /* __TEXTURES_H__ */
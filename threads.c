@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2003 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "my_math.h"
+#include "threads.h"
+
+/*
+ * a fixed pool of worker threads that help the calling thread get
+ * through a range of independent jobs; only one range is run at a time
+ */
+static pthread_t *threads = NULL;
+static int num_threads = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/* and a single background thread that runs queued jobs in order */
+struct queued_job {
+	void (*func)(void *data);
+	void *data;
+	struct queued_job *next;
+};
+
+static pthread_t queue_thread;
+static int queue_running = 0;
+static int queue_quitting = 0;
+static int queue_busy = 0;
+static struct queued_job *queue_head = NULL;
+static struct queued_job *queue_tail = NULL;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void (*job_func)(void *data, unsigned int i) = NULL;
+static void *job_data = NULL;
+static unsigned int job_next = 0;
+static unsigned int job_count = 0;
+static unsigned int job_done = 0;
+static int quitting = 0;
+
+/* run jobs until there are none left to take; called with the lock held */
+static void
+run_jobs()
+{
+	unsigned int i;
+
+	while(job_next < job_count) {
+		i = job_next++;
+		pthread_mutex_unlock(&lock);
+		job_func(job_data, i);
+		pthread_mutex_lock(&lock);
+
+		if(++job_done == job_count)
+			pthread_cond_broadcast(&done_cond);
+	}
+}
+
+static void *
+worker(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(!quitting && job_next >= job_count)
+			pthread_cond_wait(&work_cond, &lock);
+		if(quitting)
+			break;
+
+		run_jobs();
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/* runs queued jobs until told to quit, finishing whatever is queued first */
+static void *
+queue_worker(void *arg)
+{
+	struct queued_job *job;
+
+	pthread_mutex_lock(&queue_lock);
+	for(;;) {
+		while(!queue_quitting && !queue_head)
+			pthread_cond_wait(&queue_cond, &queue_lock);
+		if(!queue_head)
+			break;
+
+		job = queue_head;
+		queue_head = job->next;
+		if(!queue_head)
+			queue_tail = NULL;
+		queue_busy = 1;
+		pthread_mutex_unlock(&queue_lock);
+
+		job->func(job->data);
+		free(job);
+
+		pthread_mutex_lock(&queue_lock);
+		queue_busy = 0;
+		pthread_cond_broadcast(&queue_done_cond);
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	return NULL;
+}
+
+/*
+ * start the background thread, and num worker threads, or one less than
+ * the number of processors if num is 0 or less; returns FALSE if no
+ * workers could be started, in which case jobs are just run on the
+ * calling thread
+ */
+int
+threads_init(int num)
+{
+	int i;
+
+	if(!queue_running) {
+		queue_quitting = 0;
+		if(pthread_create(&queue_thread, NULL, queue_worker, NULL) == 0)
+			queue_running = 1;
+		else
+			fprintf(stderr, "Error: Couldn't create background thread\n");
+	}
+
+	if(threads)
+		return TRUE;
+
+	if(num <= 0)
+		num = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if(num <= 0)
+		return FALSE;
+
+	threads = malloc(sizeof(pthread_t) * num);
+	if(!threads) {
+		fprintf(stderr, "Error: Couldn't allocate memory for threads\n");
+		return FALSE;
+	}
+
+	quitting = 0;
+	for(i = 0; i < num; i++) {
+		if(pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+			fprintf(stderr, "Error: Couldn't create worker thread\n");
+			break;
+		}
+	}
+	num_threads = i;
+
+	if(num_threads == 0) {
+		free(threads);
+		threads = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+threads_shutdown()
+{
+	int i;
+
+	if(queue_running) {
+		pthread_mutex_lock(&queue_lock);
+		queue_quitting = 1;
+		pthread_cond_broadcast(&queue_cond);
+		pthread_mutex_unlock(&queue_lock);
+
+		pthread_join(queue_thread, NULL);
+		queue_running = 0;
+	}
+
+	if(!threads)
+		return;
+
+	pthread_mutex_lock(&lock);
+	quitting = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+
+	for(i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	threads = NULL;
+	num_threads = 0;
+}
+
+/* the number of threads jobs are run on, including the calling thread */
+int
+threads_count()
+{
+	return num_threads + 1;
+}
+
+/*
+ * call func(data, i) for every i below count, spread over the pool and
+ * the calling thread, and return once all of them have finished. if the
+ * pool is already busy with another thread's range, the jobs are just run
+ * on the calling thread
+ */
+void
+threads_parallel_for(void (*func)(void *data, unsigned int i), void *data,
+                     unsigned int count)
+{
+	unsigned int i;
+
+	if(!threads || count < 2) {
+		for(i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(job_count) {
+		pthread_mutex_unlock(&lock);
+		for(i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
+
+	job_func = func;
+	job_data = data;
+	job_next = 0;
+	job_done = 0;
+	job_count = count;
+	pthread_cond_broadcast(&work_cond);
+
+	run_jobs();
+	while(job_done < job_count)
+		pthread_cond_wait(&done_cond, &lock);
+
+	job_count = 0;
+	job_next = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * run func(data) on the background thread, after anything queued before
+ * it; returns FALSE if there's no background thread to run it
+ */
+int
+threads_queue(void (*func)(void *data), void *data)
+{
+	struct queued_job *job;
+
+	if(!queue_running)
+		return FALSE;
+
+	job = malloc(sizeof(struct queued_job));
+	if(!job) {
+		fprintf(stderr, "Error: Couldn't allocate memory for queued job\n");
+		return FALSE;
+	}
+	job->func = func;
+	job->data = data;
+	job->next = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+	if(queue_tail)
+		queue_tail->next = job;
+	else
+		queue_head = job;
+	queue_tail = job;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+
+	return TRUE;
+}
+
+/* wait until every queued job has been run */
+void
+threads_flush_queue()
+{
+	if(!queue_running)
+		return;
+
+	pthread_mutex_lock(&queue_lock);
+	while(queue_head || queue_busy)
+		pthread_cond_wait(&queue_done_cond, &queue_lock);
+	pthread_mutex_unlock(&queue_lock);
+}